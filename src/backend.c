@@ -0,0 +1,162 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "backend.h"
+
+#ifdef SUPATH
+#include "su_backend.h"
+#endif
+
+#ifdef SUDOPATH
+#include "sudo_backend.h"
+#endif
+
+#ifdef DOASPATH
+#include "doas_backend.h"
+#endif
+
+/* su, sudo and doas are all useless unless they can become root */
+static int probe_setuid(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0 || access(path, X_OK) < 0)
+		return 0;
+	return (st.st_mode & S_ISUID) && st.st_uid == 0;
+}
+
+static const KtsussBackend backends[] = {
+#ifdef SUPATH
+	{ "su", SUPATH, probe_setuid, spawn_check_su, check_password_su, spawn_su, run_su },
+#endif
+#ifdef SUDOPATH
+	{ "sudo", SUDOPATH, probe_setuid, spawn_check_sudo, check_password_sudo, spawn_sudo, run_sudo },
+#endif
+#ifdef DOASPATH
+	{ "doas", DOASPATH, probe_setuid, spawn_check_doas, check_password_doas, spawn_doas, run_doas },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
+/* Gets the compiled in backend called name */
+const KtsussBackend *backend_find(const char *name)
+{
+	const KtsussBackend *b;
+
+	for (b = backends; b->name; b++)
+		if (!strcmp(b->name, name))
+			return b;
+	return NULL;
+}
+
+
+/* Names of the compiled in backends, for the help text */
+const char *backend_list(void)
+{
+	static char list[64];
+	const KtsussBackend *b;
+
+	if (!*list)
+		for (b = backends; b->name; b++) {
+			if (b != backends)
+				strncat(list, ", ", sizeof(list) - strlen(list) - 1);
+			strncat(list, b->name, sizeof(list) - strlen(list) - 1);
+		}
+	return list;
+}
+
+
+/* Where we remember what the last detection came up with. Homes get shared
+ * between hosts that don't have the same backends, so it's one per host */
+static char *backend_cache_file(char *buf, size_t len)
+{
+	const char *dir;
+	char host[256];
+
+	if (gethostname(host, sizeof(host)) < 0)
+		return NULL;
+	host[sizeof(host) - 1] = '\0';
+
+	if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir)
+		snprintf(buf, len, "%s/ktsuss-backend.%s", dir, host);
+	else if ((dir = getenv("HOME")) != NULL && *dir)
+		snprintf(buf, len, "%s/.cache/ktsuss-backend.%s", dir, host);
+	else
+		return NULL;
+	return buf;
+}
+
+
+/* Find the first usable backend, starting with the one we were configured to prefer */
+const KtsussBackend *backend_detect(void)
+{
+	static const KtsussBackend *detected = NULL;
+	const KtsussBackend *b;
+	char file[1024], prefer[16], name[16];
+	FILE *fp;
+
+	if (detected)
+		return detected;
+
+	/* Trust the cached answer as long as it was made for the backend we
+	 * prefer now and that one binary still checks out */
+	if (backend_cache_file(file, sizeof(file)) && (fp = fopen(file, "r")) != NULL) {
+		if (fscanf(fp, "%15s %15s", prefer, name) == 2 && !strcmp(prefer, DEFAULT_BACKEND) &&
+		    (b = backend_find(name)) != NULL && b->probe(b->path))
+			detected = b;
+		fclose(fp);
+		if (detected)
+			return detected;
+	}
+
+	if ((b = backend_find(DEFAULT_BACKEND)) != NULL && b->probe(b->path))
+		detected = b;
+	for (b = backends; !detected && b->name; b++)
+		if (b->probe(b->path))
+			detected = b;
+
+	if (detected && backend_cache_file(file, sizeof(file)) && (fp = fopen(file, "w")) != NULL) {
+		fprintf(fp, "%s %s\n", DEFAULT_BACKEND, detected->name);
+		fclose(fp);
+	}
+	return detected;
+}
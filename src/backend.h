@@ -0,0 +1,60 @@
+
+/* vim: set sw=4 sts=4 tw=80 */
+
+/*
+ * Copyright (c) 2011 , David B. Cortarello <dcortarello@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by David B. Cortarello.
+ * 4. Neither the name of David B. Cortarello nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DAVID B. CORTARELLO 'AS IS' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL DAVID B. CORTARELLO BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* What every way of becoming somebody else has to provide */
+typedef struct {
+	const char *name;
+	const char *path;
+	/* Returns 1 if the backend can be used on this host */
+	int (*probe)(const char *path);
+	/* The spawns return the backend pid or -1. When *prompt comes back non
+	 * NULL the password still has to be written to *fdpty, once the output
+	 * shows a prompt matching it (see prompt_scan()) */
+	pid_t (*spawn_check)(const char *username, const char *password, int *fdpty, const char **prompt);
+	int (*check)(const char *username, const char *password);
+	pid_t (*spawn)(const char *username, const char *password, char **argv, int *fdpty, const char **prompt);
+	/* Returns the wait status, and what the command used in ru */
+	int (*run)(char *username, char *password, char *command, struct rusage *ru);
+} KtsussBackend;
+
+const KtsussBackend *backend_find(const char *name);
+const KtsussBackend *backend_detect(void);
+const char *backend_list(void);
+
+#endif
@@ -0,0 +1,210 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include "config.h"
+#include "coalesce.h"
+#ifdef HAVE_COALESCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "errors.h"
+
+#define MAX_FOLLOWERS 64
+
+static int followers[MAX_FOLLOWERS];
+static int nfollowers = 0;
+
+
+/* Only trust the other end if it's running as ourselves */
+static int peer_is_me(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+	return cred.uid == getuid();
+}
+
+
+/* Builds the abstract socket name for our uid, login session, backend and
+ * target user. A password checked by su is no good for sudo and the other way
+ * around, so the backend is part of it */
+static socklen_t coalesce_addr(struct sockaddr_un *addr, const char *backend, const char *username)
+{
+	FILE *fp;
+	unsigned int session = 0;
+	int n;
+
+	if ((fp = fopen("/proc/self/sessionid", "r")) != NULL) {
+		if (fscanf(fp, "%u", &session) != 1)
+			session = 0;
+		fclose(fp);
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	/* sun_path[0] stays '\0', that's what makes it abstract */
+	n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "ktsuss:%u:%u:%s:%s", (unsigned int)getuid(), session, backend, username);
+	if (n >= (int)sizeof(addr->sun_path) - 1)
+		n = sizeof(addr->sun_path) - 2;
+	return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+
+/* Become the leader for username through backend or join the one already
+ * running. Returns the socket, or -1 if there is nothing to coalesce with */
+int coalesce_open(const char *backend, const char *username, int *leader)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd;
+
+	len = coalesce_addr(&addr, backend, username);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&addr, len) == 0) {
+		if (listen(fd, MAX_FOLLOWERS) < 0) {
+			close(fd);
+			return -1;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		*leader = 1;
+		return fd;
+	}
+
+	/* Someone else is already asking, let's wait for him */
+	if (errno == EADDRINUSE && connect(fd, (struct sockaddr *)&addr, len) == 0 && peer_is_me(fd)) {
+		*leader = 0;
+		return fd;
+	}
+
+	close(fd);
+	return -1;
+}
+
+
+/* Take a new follower from the listening socket, returns 1 if there was one */
+int coalesce_accept(int lfd)
+{
+	int fd;
+
+	if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		return 0;
+
+	if (nfollowers == MAX_FOLLOWERS || !peer_is_me(fd)) {
+		close(fd);
+		return 1;
+	}
+	followers[nfollowers++] = fd;
+	return 1;
+}
+
+
+/* Tell every follower how the authentication went and stop leading */
+void coalesce_release(int lfd, int error, const char *username, const char *password)
+{
+	int i;
+	size_t ulen = strlen(username) + 1, plen = strlen(password) + 1;
+
+	/* Pick up the ones that connected after the last time we looked */
+	while (coalesce_accept(lfd))
+		;
+	close(lfd);
+
+	for (i = 0; i < nfollowers; i++) {
+		send(followers[i], &error, sizeof(error), MSG_NOSIGNAL);
+		if (error == ERR_SUCCESS) {
+			send(followers[i], username, ulen, MSG_NOSIGNAL);
+			send(followers[i], password, plen, MSG_NOSIGNAL);
+		}
+		close(followers[i]);
+	}
+	nfollowers = 0;
+}
+
+
+/* Wait for the leader's answer. Returns the leader's error code, or -1 if it
+ * went away without answering */
+int coalesce_wait(int fd, char *username, size_t ulen, char *password, size_t plen)
+{
+	char buf[512];
+	size_t got = 0, u, p;
+	ssize_t n;
+	int error;
+
+	while (got < sizeof(buf) && (n = read(fd, buf + got, sizeof(buf) - got)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		got += n;
+	}
+	close(fd);
+
+	if (got < sizeof(error)) {
+		memset(buf, '\0', sizeof(buf));
+		return -1;
+	}
+	memcpy(&error, buf, sizeof(error));
+	if (error != ERR_SUCCESS)
+		return error;
+
+	/* username\0password\0 follows, both must be there and fit */
+	got -= sizeof(error);
+	u = strnlen(buf + sizeof(error), got);
+	if (u + 1 >= got || u >= ulen)
+		p = plen;
+	else
+		p = strnlen(buf + sizeof(error) + u + 1, got - u - 1);
+	if (p >= plen || p == got - u - 1) {
+		memset(buf, '\0', sizeof(buf));
+		return -1;
+	}
+	strcpy(username, buf + sizeof(error));
+	strcpy(password, buf + sizeof(error) + u + 1);
+	memset(buf, '\0', sizeof(buf));
+	return ERR_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,244 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "config.h"
+#ifdef DOASPATH
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <err.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#if defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+#include <termios.h>
+
+#include "errors.h"
+#include "util.h"
+#include "sched_limits.h"
+#include "doas_backend.h"
+
+/* "\rdoas (user@host) password:", doas isn't translated and always asks before
+ * anything else is written, so the prompt is anchored */
+#define DOAS_PROMPT "^doas ("
+
+#ifndef DOAS_CONF
+#define DOAS_CONF "/etc/doas.conf"
+#endif
+
+/* Does a nopass rule let username run argv? doas -C answers for the exact
+ * command without running it, but only if we can read its config. Without
+ * that we can't tell, and DOAS_PROMPT being anchored keeps the password out
+ * of a command doas let through anyway */
+static int doas_nopass(const char *username, char **argv)
+{
+	char **cmd, answer[64];
+	int fd, pip[2], i, status;
+	ssize_t n = 0, got;
+	pid_t pid;
+
+	if (access(DOAS_CONF, R_OK) < 0)
+		return 0;
+
+	for (i = 0; argv[i]; i++)
+		;
+	if ((cmd = malloc((5 + i + 1) * sizeof(char *))) == NULL)
+		return 0;
+	cmd[0] = DOASPATH;
+	cmd[1] = "-C";
+	cmd[2] = DOAS_CONF;
+	cmd[3] = "-u";
+	cmd[4] = (char *)username;
+	memcpy(cmd + 5, argv, (i + 1) * sizeof(char *));
+
+	if (pipe(pip) < 0) {
+		free(cmd);
+		return 0;
+	}
+	if ((pid = fork()) < 0) {
+		close(pip[0]);
+		close(pip[1]);
+		free(cmd);
+		return 0;
+	}
+	else if (pid == 0) {
+		if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		dup2(pip[1], STDOUT_FILENO);
+		execv(cmd[0], cmd);
+		_exit(1);
+	}
+	close(pip[1]);
+	free(cmd);
+
+	/* "permit nopass", "permit" or "deny" */
+	while (n < (ssize_t)sizeof(answer) - 1 &&
+	       ((got = read(pip[0], answer + n, sizeof(answer) - 1 - n)) > 0 || (got < 0 && errno == EINTR)))
+		if (got > 0)
+			n += got;
+	answer[n] = '\0';
+	close(pip[0]);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 && !strncmp(answer, "permit nopass", 13);
+}
+
+
+/* Start doas on a new terminal running argv as username, doas reads the
+ * password from the tty so a pipe won't do. Without nopass the password has
+ * to wait for doas' own prompt, with it doas -n makes sure none comes */
+static pid_t init_doas(int *fdpty, const char *username, char **argv, int run, int nopass, const char **prompt)
+{
+	char **cmd;
+	pid_t pid;
+	int n = 0, i, errpipe[2];
+
+	for (i = 0; argv[i]; i++)
+		;
+	if ((cmd = malloc((6 + i + 1) * sizeof(char *))) == NULL)
+		return -1;
+
+	*prompt = DOAS_PROMPT;
+	cmd[n++] = DOASPATH;
+	if (nopass) {
+		cmd[n++] = "-n";
+		*prompt = NULL;
+	}
+	cmd[n++] = "-u";
+	cmd[n++] = (char *)username;
+	cmd[n++] = "--";
+	memcpy(cmd + n, argv, (i + 1) * sizeof(char *));
+
+	if (run && limits_pipe(errpipe) < 0) {
+		warn("pipe()");
+		free(cmd);
+		return -1;
+	}
+
+	/* Creates a new terminal */
+	if ((pid = forkpty(fdpty, NULL, NULL, NULL)) < 0) {
+		warn("forkpty()");
+		if (run)
+			close(errpipe[0]);
+	}
+	else if (pid == 0) {
+		setsid();
+		/* Only the check may outlive its terminal, the command has to go
+		 * when we hang up on it */
+		if (run)
+			limits_apply(errpipe[1]);
+		else
+			signal(SIGHUP, SIG_IGN);
+		execv(cmd[0], cmd);
+		warn("execv()");
+		_exit(1);
+	}
+
+	if (run) {
+		close(errpipe[1]);
+		if (pid > 0)
+			limits_collect(errpipe[0]);
+	}
+	free(cmd);
+	return pid;
+}
+
+
+/* Start checking user and password, the check is done once the returned pid exits */
+pid_t spawn_check_doas(const char *username, const char *password, int *fdpty, const char **prompt)
+{
+	char *argv[2] = { "true", NULL };
+
+	return init_doas(fdpty, username, argv, 0, 0, prompt);
+}
+
+
+/* Check user and password */
+int check_password_doas(const char *username, const char *password)
+{
+	int fdpty = 0, status = 0, pid = 0;
+	const char *prompt;
+
+	if ((pid = spawn_check_doas(username, password, &fdpty, &prompt)) < 0)
+		return ERR_CALLING_SU;
+	if (pty_login(pid, fdpty, prompt, password, -1) < 0)
+		return ERR_CALLING_SU;
+
+	waitpid(pid, &status, 0);
+
+	close(fdpty);
+
+	return check_status(status);
+}
+
+
+/* Start argv as the given user on a new terminal, doas execs it as it is */
+pid_t spawn_doas(const char *username, const char *password, char **argv, int *fdpty, const char **prompt)
+{
+	return init_doas(fdpty, username, argv, 1, 0, prompt);
+}
+
+
+/* Run the given command as the given user */
+int run_doas(char *username, char *password, char *command, struct rusage *ru)
+{
+	/* doas execs its arguments as they are, let a shell parse the command like su does */
+	char *argv[4] = { "/bin/sh", "-c", command, NULL };
+	int fdpty = 0, status = 0;
+	pid_t pid = 0;
+	const char *prompt;
+
+	/* We block here anyway, and it saves a silent command waiting for a
+	 * prompt that doesn't come */
+	if ((pid = init_doas(&fdpty, username, argv, 1, doas_nopass(username, argv), &prompt)) < 0)
+		return -1;
+	if (pty_login(pid, fdpty, prompt, password, STDOUT_FILENO) < 0)
+		return -1;
+
+	status = relay_pty(pid, fdpty, ru);
+
+	close(fdpty);
+
+	return status;
+}
+
+#endif
@@ -39,7 +39,13 @@ enum {
 	ERR_MISSING_USER_AND_COMMAND,
 	ERR_MISSING_MESSAGE_AND_COMMAND,
 	ERR_CALLING_SU,
-	ERR_INVALID_COMMAND
+	ERR_INVALID_COMMAND,
+	ERR_CANCELLED,
+	ERR_NO_BACKEND,
+	ERR_RECORDING,
+	ERR_INVALID_LIMIT,
+	ERR_MISSING_VALUE,
+	ERR_INVALID_NUMBER
 };
 
 static const char *KTS_ERRORS[] = {
@@ -51,5 +57,11 @@ static const char *KTS_ERRORS[] = {
 	"No user and command specified",
 	"No message and command specified",
 	"Unknown error calling the su command",
-	"Command passed is invalid"
+	"Command passed is invalid",
+	"Authentication cancelled",
+	"No usable su, sudo or doas found",
+	"Session recording is not available",
+	"Invalid or unsupported scheduling or resource limit",
+	"No value given for the option",
+	"Not a valid number"
 };
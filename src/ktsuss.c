@@ -39,30 +39,24 @@
 #include <errno.h>
 #include <pwd.h>
 
-#if defined(__FreeBSD__)
-#include <libutil.h>
-#include <utmpx.h>
-#else
-#include <pty.h>
-#include <utmp.h>
-#endif
-
-#include <termios.h>
 #include <glib.h>
 #include <gtk/gtk.h>
 
 #include "config.h"
 #include "errors.h"
+#include "libktsuss.h"
+#include "backend.h"
+#include "su_cache.h"
+#include "coalesce.h"
 
-#ifdef SUDOPATH
-#include "sudo_backend.h"
-#endif
-
-#ifdef SUPATH
-#include "su_backend.h"
-#endif
+/* What the authentication dialog came back with */
+typedef struct {
+	KtsussAuth *auth;
+	int error;
+} AuthResult;
 
-static struct termios orig_termios;
+/* --rusage */
+static gboolean report_usage = FALSE;
 
 /* Print's the help text to the terminal and exits with error */
 void say_help(char *str)
@@ -73,6 +67,26 @@ void say_help(char *str)
 	printf("\t-v, --version        Gives ktsuss version info\n");
 	printf("\t-u, --user USER      Runs the command as the given user\n");
 	printf("\t-m, --message MESG   Change default message in ktsuss window\n");
+	printf("\t-b, --backend NAME   Use the given backend (%s or auto)\n", backend_list());
+	printf("\t-r, --record FILE    Record the session into FILE and FILE.timing for scriptreplay\n");
+	printf("\t--record-buffer KB   Memory the recording may use before dropping data\n");
+#ifdef HAVE_LIBZ
+	printf("\t-z, --record-gzip    Compress the recording\n");
+#endif
+	printf("\t-n, --nice N         Run the command with niceness N\n");
+	printf("\t--ionice CLASS[:N]   Run the command in I/O class realtime, best-effort or idle\n");
+	printf("\t--cpus LIST          Run the command on the given CPUs only (e.g. 0,2-3)\n");
+	printf("\t--limit RES=N        Set a resource limit: as, core, cpu, data, fsize, nofile,\n");
+	printf("\t                     nproc, stack or memlock\n");
+	printf("\t--cpu-timeout SECS   Stop the command after SECS seconds of CPU time\n");
+	printf("\t--timeout SECS       Stop the command after SECS seconds\n");
+	printf("\t--rusage             Report the resources used by the command when it's done\n");
+#ifdef HAVE_SU_CACHE
+	printf("\t-c, --cache SECS     Remember the password in the session keyring for SECS seconds.\n");
+	printf("\t                     It's the real password: every process of the login session\n");
+	printf("\t                     can read it back meanwhile\n");
+	printf("\t-k, --forget         Forget any remembered password\n");
+#endif
 	printf("\t-h, --help           Show this help\n");
 	exit(1);
 }
@@ -91,16 +105,7 @@ void say_about(void)
 /* Creates a dialog with the given text error */
 void Werror(int type, char *err_msg, int exit_true, int ret)
 {
-	GtkWidget *dialog_error;
-	if (!err_msg)
-		dialog_error = gtk_message_dialog_new(NULL, 0, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, "Could not run command");
-	else
-		dialog_error = gtk_message_dialog_new(NULL, 0, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, err_msg);
-
-	gtk_window_set_title(GTK_WINDOW(dialog_error), "ktsuss");
-	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog_error), KTS_ERRORS[type]);
-	gtk_dialog_run(GTK_DIALOG(dialog_error));
-	gtk_widget_destroy(dialog_error);
+	ktsuss_error_dialog(NULL, type, err_msg);
 
 	/* In case exit is needed, let's just exit */
 	if (exit_true)
@@ -132,55 +137,112 @@ char *get_real_name(const char *command)
 }
 
 
-/* Set the terminal in raw mode (ttyfd must be a valid terminal file descriptor) */
-void tty_raw(int ttyfd)
+/* A plain decimal number no bigger than max, or we complain and leave */
+static unsigned long parse_number(char *value, unsigned long max)
+{
+	unsigned long n;
+	char *end;
+
+	errno = 0;
+	n = strtoul(value, &end, 10);
+	if (!g_ascii_isdigit(*value) || *end || errno || n > max)
+		Werror(ERR_INVALID_NUMBER, value, 1, 1);
+	return n;
+}
+
+
+/* The dialog is done, get out of the main loop */
+static void auth_done(KtsussAuth *auth, int error, gpointer data)
+{
+	AuthResult *result = data;
+
+	result->auth = auth;
+	result->error = error;
+	gtk_main_quit();
+}
+
+
+/* Tell what the command just run used, if we were asked to */
+static void report_rusage(GTimer *timer)
 {
-	struct termios raw;
-
-	memcpy(&raw, &orig_termios, sizeof(struct termios));
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-    raw.c_oflag &= ~(OPOST);
-    raw.c_cflag |= (CS8);
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-    raw.c_cc[VMIN] = 5; raw.c_cc[VTIME] = 8;
-    raw.c_cc[VMIN] = 0; raw.c_cc[VTIME] = 0;
-    raw.c_cc[VMIN] = 2; raw.c_cc[VTIME] = 0;
-    raw.c_cc[VMIN] = 0; raw.c_cc[VTIME] = 8;
-    if (tcsetattr(ttyfd, TCSAFLUSH, &raw) < 0) 
-		err(1, "tcsetattr()");
+	const struct rusage *ru = ktsuss_get_rusage();
+
+	if (!report_usage)
+		return;
+	fprintf(stderr, "ktsuss: real %.2fs user %.2fs sys %.2fs maxrss %ldKB majflt %ld inblock %ld oublock %ld\n",
+			g_timer_elapsed(timer, NULL),
+			ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+			ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6,
+			ru->ru_maxrss, ru->ru_majflt, ru->ru_inblock, ru->ru_oublock);
 }
 
 
+/* Run the command with credentials we didn't have to ask for, returns FALSE
+ * if they turned out to be wrong and nothing was run */
+static gboolean run_as(const char *username, const char *password, char *command)
+{
+	KtsussAuth *auth = ktsuss_auth_new(username, password);
+	GTimer *timer = g_timer_new();
+	gboolean good = TRUE;
+	int status;
+
+	status = ktsuss_run(auth, command);
+	/* su exits 1 on a wrong password, tell that apart from the command doing so */
+	if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 1 && ktsuss_check(auth) != ERR_SUCCESS)
+		good = FALSE;
+	else
+		report_rusage(timer);
+	g_timer_destroy(timer);
+	ktsuss_auth_free(auth);
+	return good;
+}
+
+
+#ifdef HAVE_COALESCE
+/* Pick up the other ktsuss waiting for us while the dialog is up */
+static gboolean coalesce_cb(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	while (coalesce_accept(g_io_channel_unix_get_fd(source)))
+		;
+	return TRUE;
+}
+#endif
+
+
 int main(int argc, char *argv[])
 {
 	gboolean explicit_username = FALSE;
 	gboolean explicit_message = FALSE;
 	int error = 0;
-	int m = 0, i = 1;
-	guint counter = 0;
+	int i = 1;
 	gchar *command = NULL;
 	gchar *command_run = NULL;
 	gchar *username = NULL;
-	gchar *password = NULL;
+	AuthResult result = { NULL, 0 };
+	gchar *backend_name = NULL;
+	gchar *record = NULL;
+	gsize record_buffer = 0;
+	gboolean record_gzip = FALSE;
+#ifdef HAVE_SU_CACHE
+	unsigned int cache_ttl = 0;
+	gboolean forget = FALSE;
+	char cached[SU_CACHE_MAX_PASSWD];
+#endif
+#ifdef HAVE_COALESCE
+	int coalesce_fd = -1, leader = 0;
+	guint coalesce_watch = 0;
+	GIOChannel *coalesce_chan;
+	char shared_user[256], shared_pass[64];
+#endif
 
 	uid_t whoami;
 	struct passwd *pw;
 
-	char err_msg[256];
-
 	gchar *message = NULL;
 
 	char **cmd_argv = NULL;
 	GError *cmd_error = NULL;
-
-	GtkWidget *dialog;
-	GtkSizeGroup *sizegroup;
-	GtkWidget *hbox;
-	GtkWidget *image;
-	GtkWidget *align;
-	GtkWidget *label;
-	GtkWidget *user;
-	GtkWidget *pass;
+	GTimer *timer;
 
 	gtk_init(&argc, &argv);
 
@@ -204,12 +266,72 @@ int main(int argc, char *argv[])
 			explicit_message = TRUE;
 			i += 1;
 		}
+		if (!strcmp(argv[i], "--backend") || !strcmp(argv[i], "-b")) {
+			if ((backend_name = argv[i + 1]) == NULL)
+				Werror(ERR_MISSING_VALUE, argv[i], 1, 1);
+			i += 1;
+		}
+		if (!strcmp(argv[i], "--record") || !strcmp(argv[i], "-r")) {
+			if ((record = argv[i + 1]) == NULL)
+				Werror(ERR_MISSING_VALUE, argv[i], 1, 1);
+			i += 1;
+		}
+		if (!strcmp(argv[i], "--record-buffer")) {
+			if (argv[i + 1] == NULL)
+				Werror(ERR_MISSING_VALUE, argv[i], 1, 1);
+			record_buffer = parse_number(argv[i + 1], G_MAXSIZE / 1024) * 1024;
+			i += 1;
+		}
+		if (!strcmp(argv[i], "--record-gzip") || !strcmp(argv[i], "-z"))
+			record_gzip = TRUE;
+		if (!strcmp(argv[i], "--nice") || !strcmp(argv[i], "-n") || !strcmp(argv[i], "--ionice") || !strcmp(argv[i], "--cpus")
+				|| !strcmp(argv[i], "--limit") || !strcmp(argv[i], "--cpu-timeout") || !strcmp(argv[i], "--timeout")) {
+			if (argv[i + 1] == NULL)
+				Werror(ERR_MISSING_VALUE, argv[i], 1, 1);
+			/* The option names are the control names, -n aside */
+			if (!ktsuss_set_limit(!strcmp(argv[i], "-n") ? "nice" : argv[i] + 2, argv[i + 1]))
+				Werror(ERR_INVALID_LIMIT, argv[i + 1], 1, 1);
+			i += 1;
+		}
+		if (!strcmp(argv[i], "--rusage"))
+			report_usage = TRUE;
+#ifdef HAVE_SU_CACHE
+		if (!strcmp(argv[i], "--cache") || !strcmp(argv[i], "-c")) {
+			if (argv[i + 1] == NULL)
+				Werror(ERR_MISSING_VALUE, argv[i], 1, 1);
+			cache_ttl = parse_number(argv[i + 1], G_MAXUINT);
+			i += 1;
+		}
+		if (!strcmp(argv[i], "--forget") || !strcmp(argv[i], "-k"))
+			forget = TRUE;
+#endif
 		i += 1;
 	}
 
+#ifdef HAVE_SU_CACHE
+	if (forget) {
+		su_cache_forget();
+		/* Just like sudo -k, forgetting alone is a valid request */
+		if (argv[i] == NULL)
+			exit(0);
+	}
+#endif
+
 	if (argv[i] == NULL)
 		Werror(ERR_MISSING_COMMAND, NULL, 1, 1);
 
+	if (!ktsuss_set_backend(backend_name))
+		Werror(ERR_NO_BACKEND, backend_name, 1, 1);
+
+	if (record && !ktsuss_set_recording(record, record_buffer, record_gzip))
+		Werror(ERR_RECORDING, record, 1, 1);
+
+#ifdef HAVE_SU_CACHE
+	/* The keyring cache is only wired up for the su backend */
+	if (strcmp(ktsuss_get_backend(), "su"))
+		cache_ttl = 0;
+#endif
+
 	/* handle arguments and spaces in the subcommand correctly */
 	if (! g_shell_parse_argv(argv[i], NULL, &cmd_argv, &cmd_error))
 		/* Something bad has happened */
@@ -238,106 +360,92 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
-	if (explicit_username && !explicit_message)
-		message = g_strdup_printf("Please enter the\npassword for %s:", username);
-	else if (!explicit_message)
-		message = g_strdup("Please enter the desired\nusername and password:");
-
-	dialog = gtk_dialog_new_with_buttons(command, NULL, GTK_DIALOG_NO_SEPARATOR, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_OK, GTK_RESPONSE_OK, NULL);
-	gtk_window_set_title(GTK_WINDOW(dialog), cmd_argv[0]);
-	gtk_window_set_icon_name(GTK_WINDOW(dialog), "ktsuss");
-	gtk_container_set_border_width(GTK_CONTAINER(dialog), 5);
-	gtk_container_set_border_width(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), 5);
-	gtk_box_set_spacing(GTK_BOX(GTK_DIALOG(dialog)->vbox), 5);
-	hbox = gtk_hbox_new(FALSE, 6);
-#if GTK_CHECK_VERSION(2, 10, 0)
-	image = gtk_image_new_from_stock(GTK_STOCK_DIALOG_AUTHENTICATION, GTK_ICON_SIZE_DIALOG);
-#else
-	image = gtk_image_new_from_icon_name("ktsuss", GTK_ICON_SIZE_DIALOG);
-#endif
-	gtk_box_pack_start(GTK_BOX(hbox), image, FALSE, FALSE, 0);
-	label = gtk_label_new(message);
-	gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
-	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
-	sizegroup = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
-	if (!explicit_username) {
-		hbox = gtk_hbox_new(FALSE, 6);
-		label = gtk_label_new("Username");
-		align = gtk_alignment_new(0, 0.5, 0, 0);
-		gtk_container_add(GTK_CONTAINER(align), label);
-		gtk_size_group_add_widget(sizegroup, align);
-		gtk_box_pack_start(GTK_BOX(hbox), align, FALSE, FALSE, 0);
-		user = gtk_entry_new();
-		gtk_entry_set_text(GTK_ENTRY(user), username ? username : "root");
-		gtk_box_pack_start(GTK_BOX(hbox), user, FALSE, FALSE, 0);
-		gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
-	}
-	hbox = gtk_hbox_new(FALSE, 6);
-	label = gtk_label_new("Password");
-	align = gtk_alignment_new(0, 0.5, 0, 0);
-	gtk_container_add(GTK_CONTAINER(align), label);
-	gtk_size_group_add_widget(sizegroup, align);
-	gtk_box_pack_start(GTK_BOX(hbox), align, FALSE, FALSE, 0);
-	pass = gtk_entry_new_with_max_length(32);
-	gtk_entry_set_visibility(GTK_ENTRY(pass), FALSE);
-	gtk_box_pack_start(GTK_BOX(hbox), pass, FALSE, FALSE, 0);
-	gtk_entry_set_activates_default(GTK_ENTRY(pass), TRUE);
-	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
-	gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_OK);
-	gtk_widget_grab_focus(pass);
-	gtk_widget_show_all(GTK_DIALOG(dialog)->vbox);
-
-	/* Show the dialog up to 3 times */
-	while (counter < 3) {
-		if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_OK) {
+#ifdef HAVE_SU_CACHE
+	/* Still authorized from a previous run, skip the dialog and the password check */
+	if (cache_ttl && su_cache_lookup(username, cached, sizeof(cached))) {
+		command_run = g_strjoinv(" ", &argv[i]);
+		error = !run_as(username, cached, command_run);
+		memset(cached, '\0', sizeof(cached));
+		g_free(command_run);
+		if (!error) {
 			if (!explicit_username)
-				username = strdup(gtk_entry_get_text(GTK_ENTRY(user)));
-			password = strdup(gtk_entry_get_text(GTK_ENTRY(pass)));
+				g_free(username);
+			g_strfreev(cmd_argv);
+			return 0;
+		}
+		/* The password changed since it was cached, forget it and ask */
+		su_cache_drop(username);
+		error = 0;
+	}
+#endif
 
-#ifdef SUDOPATH
-			if ((error = check_password_sudo(username, password)) == ERR_SUCCESS) {
-#else
-			if ((error = check_password_su(username, password)) == ERR_SUCCESS) {
+#ifdef HAVE_COALESCE
+	/* Somebody in this session is already asking for the same user through the same backend, wait for his answer */
+	if ((coalesce_fd = coalesce_open(ktsuss_get_backend(), username, &leader)) >= 0 && !leader) {
+		error = coalesce_wait(coalesce_fd, shared_user, sizeof(shared_user), shared_pass, sizeof(shared_pass));
+		coalesce_fd = -1;
+		if (error == ERR_SUCCESS && (!explicit_username || !strcmp(username, shared_user))) {
+			command_run = g_strjoinv(" ", &argv[i]);
+			run_as(shared_user, shared_pass, command_run);
+			memset(shared_pass, '\0', sizeof(shared_pass));
+			g_free(command_run);
+			if (!explicit_username)
+				g_free(username);
+			g_strfreev(cmd_argv);
+			return 0;
+		}
+		memset(shared_pass, '\0', sizeof(shared_pass));
+		/* The user already said no in the leader's dialog, don't ask again */
+		if (error > 0)
+			exit(1);
+		/* Otherwise the leader went away or chose somebody else, ask ourselves */
+		error = 0;
+	}
+	if (leader) {
+		coalesce_chan = g_io_channel_unix_new(coalesce_fd);
+		coalesce_watch = g_io_add_watch(coalesce_chan, G_IO_IN, coalesce_cb, NULL);
+		g_io_channel_unref(coalesce_chan);
+	}
 #endif
-				gtk_widget_destroy(dialog);
-				while (gtk_events_pending())
-					gtk_main_iteration();
-				dialog = NULL;
-				/* using argv instead of cmd_argv is fine, because 'su' is going
-				 * to implement its only parsing nevertheless */
-				command_run = g_strjoinv(" ", &argv[i]);
-#ifdef SUDOPATH
-				run_sudo(username, password, command_run);
-#else
-				run_su(username, password, command_run);
+
+	/* Let the library ask for the password, we just wait for its answer */
+	ktsuss_authenticate_async(NULL, explicit_username ? username : NULL, explicit_message ? message : NULL,
+			cmd_argv[0], auth_done, &result);
+	gtk_main();
+	error = result.error;
+
+	if (result.auth) {
+#ifdef HAVE_SU_CACHE
+		su_cache_store(ktsuss_auth_get_username(result.auth), ktsuss_auth_get_password(result.auth), cache_ttl);
 #endif
-				g_free(command_run);
-
-				counter = 3;
-			}
-			if (!explicit_username) {
-				free(username);
-				username = NULL;
-			}
-			memset(password, '\0', strlen(password));
-			free(password);
-			if (error != ERR_SUCCESS) {
-				snprintf(err_msg, sizeof(err_msg), "Could not run '%s'", command);
-				Werror(error, err_msg, 0, 0);
-				counter++;
-			}
+#ifdef HAVE_COALESCE
+		/* Let the followers go with the same credentials */
+		if (leader) {
+			g_source_remove(coalesce_watch);
+			coalesce_release(coalesce_fd, ERR_SUCCESS, ktsuss_auth_get_username(result.auth), ktsuss_auth_get_password(result.auth));
+			leader = 0;
 		}
-		else
-			break;
-		if (counter < 3)
-			gtk_widget_grab_focus(pass);
+#endif
+		/* using argv instead of cmd_argv is fine, because 'su' is going
+		 * to implement its only parsing nevertheless */
+		command_run = g_strjoinv(" ", &argv[i]);
+		timer = g_timer_new();
+		ktsuss_run(result.auth, command_run);
+		report_rusage(timer);
+		g_timer_destroy(timer);
+		g_free(command_run);
+		ktsuss_auth_free(result.auth);
+	}
+
+#ifdef HAVE_COALESCE
+	/* Cancelled or out of tries, the followers shouldn't ask again */
+	if (leader) {
+		g_source_remove(coalesce_watch);
+		coalesce_release(coalesce_fd, error, "", "");
 	}
+#endif
 
 	/* Clean up process */
-	if (dialog)
-		gtk_widget_destroy(dialog);
-	if ((explicit_username && !explicit_message) || !explicit_message)
-        free(message);
 	if (!explicit_username && username)
 		g_free(username);
 	
@@ -0,0 +1,656 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ * Copyright (c) 2007-2011, Christian Dywan
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "config.h"
+#include "errors.h"
+#include "util.h"
+#include "backend.h"
+#include "recorder.h"
+#include "sched_limits.h"
+#include "libktsuss.h"
+
+struct _KtsussAuth {
+	gchar *username;
+	gchar *password;
+};
+
+/* State of one authentication dialog */
+typedef struct {
+	GtkWidget *dialog;
+	GtkWidget *user;
+	GtkWidget *pass;
+	gchar *username;
+	gchar *password;
+	guint counter;
+	gboolean checking;
+	pid_t pid;
+	int fdpty;
+	PromptScan scan;
+	gboolean prompted;
+	gboolean answered;
+	guint watch;
+	guint poll;
+	guint timeout;
+	KtsussAuthFunc callback;
+	gpointer data;
+} KtsussDialog;
+
+/* State of one launched command */
+typedef struct {
+	KtsussOutputFunc output;
+	KtsussExitFunc exited;
+	gpointer data;
+	pid_t pid;
+	int fdpty;
+	PromptScan scan;
+	gboolean prompted;
+	gchar *password;
+	guint poll;
+	guint timeout;
+	guint reap;
+	guint expire;
+	int stage;
+	int status;
+	struct rusage ru;
+	gboolean gone;
+	gboolean drained;
+} KtsussLaunch;
+
+static const KtsussBackend *backend = NULL;
+/* What the command of the last ktsuss_run() used */
+static struct rusage run_rusage;
+
+
+/* Use the backend called name, or the first usable one if name is NULL or "auto" */
+gboolean ktsuss_set_backend(const gchar *name)
+{
+	const KtsussBackend *b;
+
+	if (!name || !strcmp(name, "auto"))
+		b = backend_detect();
+	else if ((b = backend_find(name)) != NULL && !b->probe(b->path))
+		b = NULL;
+
+	if (!b)
+		return FALSE;
+	backend = b;
+	return TRUE;
+}
+
+
+const gchar *ktsuss_get_backend(void)
+{
+	if (!backend && !ktsuss_set_backend(NULL))
+		return NULL;
+	return backend->name;
+}
+
+
+KtsussAuth *ktsuss_auth_new(const gchar *username, const gchar *password)
+{
+	KtsussAuth *auth = g_new0(KtsussAuth, 1);
+
+	auth->username = g_strdup(username);
+	auth->password = g_strdup(password);
+	return auth;
+}
+
+
+const gchar *ktsuss_auth_get_username(KtsussAuth *auth)
+{
+	return auth->username;
+}
+
+
+const gchar *ktsuss_auth_get_password(KtsussAuth *auth)
+{
+	return auth->password;
+}
+
+
+/* Forget the credentials, wiping the password out of memory */
+void ktsuss_auth_free(KtsussAuth *auth)
+{
+	if (!auth)
+		return;
+	memset(auth->password, '\0', strlen(auth->password));
+	g_free(auth->password);
+	g_free(auth->username);
+	g_free(auth);
+}
+
+
+const gchar *ktsuss_strerror(int error)
+{
+	if (error < 0 || error >= (int)G_N_ELEMENTS(KTS_ERRORS))
+		return "Unknown error";
+	return KTS_ERRORS[error];
+}
+
+
+/* Creates a dialog with the given text error */
+void ktsuss_error_dialog(GtkWindow *parent, int error, const gchar *err_msg)
+{
+	GtkWidget *dialog_error;
+	if (!err_msg)
+		dialog_error = gtk_message_dialog_new(parent, 0, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, "Could not run command");
+	else
+		dialog_error = gtk_message_dialog_new(parent, 0, GTK_MESSAGE_ERROR, GTK_BUTTONS_OK, "%s", err_msg);
+
+	gtk_window_set_title(GTK_WINDOW(dialog_error), "ktsuss");
+	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog_error), "%s", ktsuss_strerror(error));
+	gtk_dialog_run(GTK_DIALOG(dialog_error));
+	gtk_widget_destroy(dialog_error);
+}
+
+
+/* Tear the dialog down and tell the caller how it went */
+static void dialog_finish(KtsussDialog *kd, int error)
+{
+	KtsussAuth *auth = NULL;
+
+	if (error == ERR_SUCCESS)
+		auth = ktsuss_auth_new(kd->username, kd->password);
+
+	gtk_widget_destroy(kd->dialog);
+	while (gtk_events_pending())
+		gtk_main_iteration();
+
+	if (kd->password) {
+		memset(kd->password, '\0', strlen(kd->password));
+		g_free(kd->password);
+	}
+	g_free(kd->username);
+
+	kd->callback(auth, error, kd->data);
+	g_free(kd);
+}
+
+
+/* The password check is over */
+static void check_done(GPid pid, gint status, gpointer data)
+{
+	KtsussDialog *kd = data;
+	int error;
+	gchar *err_msg;
+
+	g_spawn_close_pid(pid);
+	kd->checking = FALSE;
+	if (kd->watch)
+		g_source_remove(kd->watch);
+	if (kd->poll)
+		g_source_remove(kd->poll);
+	if (kd->timeout)
+		g_source_remove(kd->timeout);
+	kd->watch = kd->poll = kd->timeout = 0;
+	if (kd->fdpty >= 0)
+		close(kd->fdpty);
+	kd->fdpty = -1;
+
+	if ((error = check_status(status)) == ERR_SUCCESS) {
+		dialog_finish(kd, ERR_SUCCESS);
+		return;
+	}
+
+	err_msg = g_strdup_printf("Could not authenticate as '%s'", kd->username);
+	ktsuss_error_dialog(GTK_WINDOW(kd->dialog), error, err_msg);
+	g_free(err_msg);
+
+	/* Show the dialog up to 3 times */
+	if (++kd->counter == 3) {
+		dialog_finish(kd, error);
+		return;
+	}
+
+	memset(kd->password, '\0', strlen(kd->password));
+	g_free(kd->password);
+	kd->password = NULL;
+	gtk_entry_set_text(GTK_ENTRY(kd->pass), "");
+	gtk_widget_set_sensitive(kd->dialog, TRUE);
+	gtk_widget_grab_focus(kd->pass);
+}
+
+
+/* The backend asked, the password goes in as soon as echo is off */
+static gboolean check_answer(gpointer data)
+{
+	KtsussDialog *kd = data;
+
+	if (!pty_echo_off(kd->fdpty))
+		return TRUE;
+	pty_send_password(kd->fdpty, kd->password);
+	kd->answered = TRUE;
+	kd->poll = 0;
+	return FALSE;
+}
+
+
+/* Look for the prompt, and keep the terminal drained */
+static gboolean check_output(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	KtsussDialog *kd = data;
+	gchar buf[1024];
+	gssize n;
+	gsize used;
+
+	if ((n = read(kd->fdpty, buf, sizeof(buf))) < 0 && errno == EINTR)
+		return TRUE;
+	if (n <= 0) {
+		kd->watch = 0;
+		return FALSE;
+	}
+	if (kd->prompted || !(used = prompt_scan(&kd->scan, buf, n)))
+		return TRUE;
+	kd->prompted = TRUE;
+	/* Let through without being asked, there's nothing to answer */
+	if (used == PROMPT_NONE)
+		kd->answered = TRUE;
+	else if (check_answer(kd))
+		kd->poll = g_timeout_add(1, check_answer, kd);
+	return TRUE;
+}
+
+
+/* The backend never asked, put it down and let check_done() report it */
+static gboolean check_timeout(gpointer data)
+{
+	KtsussDialog *kd = data;
+
+	kd->timeout = 0;
+	if (!kd->answered)
+		kill(kd->pid, SIGKILL);
+	return FALSE;
+}
+
+
+static void dialog_response(GtkDialog *dialog, gint response, gpointer data)
+{
+	KtsussDialog *kd = data;
+	GIOChannel *chan;
+	const gchar *prompt;
+
+	/* Insensitive doesn't stop the window manager from closing us, and
+	 * check_done() still needs kd, so nothing goes until the check is over */
+	if (kd->checking)
+		return;
+
+	if (response != GTK_RESPONSE_OK) {
+		dialog_finish(kd, ERR_CANCELLED);
+		return;
+	}
+
+	if (kd->user) {
+		g_free(kd->username);
+		kd->username = g_strdup(gtk_entry_get_text(GTK_ENTRY(kd->user)));
+	}
+	kd->password = g_strdup(gtk_entry_get_text(GTK_ENTRY(kd->pass)));
+
+	if (!ktsuss_get_backend()) {
+		dialog_finish(kd, ERR_NO_BACKEND);
+		return;
+	}
+
+	/* Keep the dialog up but quiet while the backend makes up its mind */
+	gtk_widget_set_sensitive(kd->dialog, FALSE);
+	if ((kd->pid = backend->spawn_check(kd->username, kd->password, &kd->fdpty, &prompt)) < 0) {
+		dialog_finish(kd, ERR_CALLING_SU);
+		return;
+	}
+	kd->checking = TRUE;
+	if (prompt) {
+		prompt_init(&kd->scan, prompt);
+		kd->prompted = kd->answered = FALSE;
+		chan = g_io_channel_unix_new(kd->fdpty);
+		kd->watch = g_io_add_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR, check_output, kd);
+		g_io_channel_unref(chan);
+		kd->timeout = g_timeout_add_seconds(PROMPT_TIMEOUT, check_timeout, kd);
+	}
+	g_child_watch_add(kd->pid, check_done, kd);
+}
+
+
+void ktsuss_authenticate_async(GtkWindow *parent, const gchar *username, const gchar *message,
+		const gchar *title, KtsussAuthFunc callback, gpointer data)
+{
+	KtsussDialog *kd = g_new0(KtsussDialog, 1);
+	GtkSizeGroup *sizegroup;
+	GtkWidget *dialog;
+	GtkWidget *hbox;
+	GtkWidget *image;
+	GtkWidget *align;
+	GtkWidget *label;
+	gchar *default_message = NULL;
+
+	kd->callback = callback;
+	kd->data = data;
+	kd->fdpty = -1;
+	kd->username = g_strdup(username ? username : "root");
+
+	if (username && !message)
+		message = default_message = g_strdup_printf("Please enter the\npassword for %s:", username);
+	else if (!message)
+		message = default_message = g_strdup("Please enter the desired\nusername and password:");
+
+	dialog = gtk_dialog_new_with_buttons(title, parent, GTK_DIALOG_NO_SEPARATOR, GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, GTK_STOCK_OK, GTK_RESPONSE_OK, NULL);
+	kd->dialog = dialog;
+	gtk_window_set_title(GTK_WINDOW(dialog), title ? title : "ktsuss");
+	gtk_window_set_icon_name(GTK_WINDOW(dialog), "ktsuss");
+	gtk_container_set_border_width(GTK_CONTAINER(dialog), 5);
+	gtk_container_set_border_width(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), 5);
+	gtk_box_set_spacing(GTK_BOX(GTK_DIALOG(dialog)->vbox), 5);
+	hbox = gtk_hbox_new(FALSE, 6);
+#if GTK_CHECK_VERSION(2, 10, 0)
+	image = gtk_image_new_from_stock(GTK_STOCK_DIALOG_AUTHENTICATION, GTK_ICON_SIZE_DIALOG);
+#else
+	image = gtk_image_new_from_icon_name("ktsuss", GTK_ICON_SIZE_DIALOG);
+#endif
+	gtk_box_pack_start(GTK_BOX(hbox), image, FALSE, FALSE, 0);
+	label = gtk_label_new(message);
+	gtk_box_pack_start(GTK_BOX(hbox), label, FALSE, FALSE, 0);
+	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
+	sizegroup = gtk_size_group_new(GTK_SIZE_GROUP_HORIZONTAL);
+	if (!username) {
+		hbox = gtk_hbox_new(FALSE, 6);
+		label = gtk_label_new("Username");
+		align = gtk_alignment_new(0, 0.5, 0, 0);
+		gtk_container_add(GTK_CONTAINER(align), label);
+		gtk_size_group_add_widget(sizegroup, align);
+		gtk_box_pack_start(GTK_BOX(hbox), align, FALSE, FALSE, 0);
+		kd->user = gtk_entry_new();
+		gtk_entry_set_text(GTK_ENTRY(kd->user), kd->username);
+		gtk_box_pack_start(GTK_BOX(hbox), kd->user, FALSE, FALSE, 0);
+		gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
+	}
+	hbox = gtk_hbox_new(FALSE, 6);
+	label = gtk_label_new("Password");
+	align = gtk_alignment_new(0, 0.5, 0, 0);
+	gtk_container_add(GTK_CONTAINER(align), label);
+	gtk_size_group_add_widget(sizegroup, align);
+	gtk_box_pack_start(GTK_BOX(hbox), align, FALSE, FALSE, 0);
+	kd->pass = gtk_entry_new_with_max_length(32);
+	gtk_entry_set_visibility(GTK_ENTRY(kd->pass), FALSE);
+	gtk_box_pack_start(GTK_BOX(hbox), kd->pass, FALSE, FALSE, 0);
+	gtk_entry_set_activates_default(GTK_ENTRY(kd->pass), TRUE);
+	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), hbox);
+	gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_OK);
+	g_object_unref(sizegroup);
+	g_free(default_message);
+
+	g_signal_connect(dialog, "response", G_CALLBACK(dialog_response), kd);
+	gtk_widget_grab_focus(kd->pass);
+	gtk_widget_show_all(dialog);
+}
+
+
+static void launch_forget_password(KtsussLaunch *kl)
+{
+	if (!kl->password)
+		return;
+	memset(kl->password, '\0', strlen(kl->password));
+	g_free(kl->password);
+	kl->password = NULL;
+}
+
+
+/* The backend asked, the password goes in as soon as echo is off */
+static gboolean launch_answer(gpointer data)
+{
+	KtsussLaunch *kl = data;
+
+	if (!pty_echo_off(kl->fdpty))
+		return TRUE;
+	pty_send_password(kl->fdpty, kl->password);
+	launch_forget_password(kl);
+	kl->poll = 0;
+	return FALSE;
+}
+
+
+/* The backend never asked for the password, there's no point in waiting */
+static gboolean launch_timeout(gpointer data)
+{
+	KtsussLaunch *kl = data;
+
+	kl->timeout = 0;
+	if (!kl->password)
+		return FALSE;
+	/* Silence where an anchored prompt goes means the backend didn't ask */
+	if (kl->scan.anchored && !kl->prompted) {
+		launch_forget_password(kl);
+		if (kl->output && kl->scan.len)
+			kl->output(kl->scan.line, kl->scan.len, kl->data);
+	}
+	else
+		kill(kl->pid, SIGKILL);
+	return FALSE;
+}
+
+
+/* Only tell about the exit once the output is all delivered */
+static void launch_finish(KtsussLaunch *kl)
+{
+	if (!kl->gone || !kl->drained)
+		return;
+	if (kl->poll)
+		g_source_remove(kl->poll);
+	if (kl->timeout)
+		g_source_remove(kl->timeout);
+	if (kl->expire)
+		g_source_remove(kl->expire);
+	launch_forget_password(kl);
+	if (kl->exited)
+		kl->exited(kl->status, &kl->ru, kl->data);
+	g_free(kl);
+}
+
+
+static gboolean launch_output(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+	KtsussLaunch *kl = data;
+	gchar buf[1024], *p = buf;
+	gssize n;
+	gsize used;
+
+	if ((n = read(g_io_channel_unix_get_fd(source), buf, sizeof(buf))) > 0) {
+		/* Until the prompt shows up, what we get is the backend asking for the password */
+		if (kl->password && !kl->prompted) {
+			if (!(used = prompt_scan(&kl->scan, buf, n)))
+				return TRUE;
+			kl->prompted = TRUE;
+			if (used == PROMPT_NONE) {
+				/* The backend didn't ask, this is the command already */
+				launch_forget_password(kl);
+				if (kl->output && kl->scan.len)
+					kl->output(kl->scan.line, kl->scan.len, kl->data);
+				used = kl->scan.rest;
+			}
+			else if (launch_answer(kl))
+				kl->poll = g_timeout_add(1, launch_answer, kl);
+			p += used;
+			if (!(n -= used))
+				return TRUE;
+		}
+		if (kl->output)
+			kl->output(p, n, kl->data);
+		return TRUE;
+	}
+	if (n < 0 && errno == EINTR)
+		return TRUE;
+
+	/* EOF or EIO, the terminal has no one left on the other side */
+	if (kl->poll)
+		g_source_remove(kl->poll);
+	kl->poll = 0;
+	close(g_io_channel_unix_get_fd(source));
+	kl->drained = TRUE;
+	launch_finish(kl);
+	return FALSE;
+}
+
+
+/* GLib's child watch doesn't tell what the command used, so we wait4() for
+ * it ourselves */
+static gboolean launch_reap(gpointer data)
+{
+	KtsussLaunch *kl = data;
+	pid_t gone;
+	int status;
+
+	if ((gone = wait4(kl->pid, &status, WNOHANG, &kl->ru)) == 0 || (gone < 0 && errno == EINTR))
+		return TRUE;
+	kl->reap = 0;
+	kl->status = gone > 0 ? status : -1;
+	kl->gone = TRUE;
+	launch_finish(kl);
+	return FALSE;
+}
+
+
+/* The "timeout" limit is up: SIGTERM, SIGKILL 5 seconds later, and if it's
+ * still there 5 seconds after that it's left behind. A backend out of our
+ * reach (doas runs the command as root) gets its terminal hung up instead,
+ * that one the kernel delivers */
+static gboolean launch_expire(gpointer data)
+{
+	KtsussLaunch *kl = data;
+
+	kl->expire = 0;
+	if (kl->stage < 2) {
+		/* Gone already but something still holds the terminal, the hangup is for that */
+		if ((kl->gone || kill(kl->pid, kl->stage ? SIGKILL : SIGTERM) < 0) && !kl->drained)
+			pty_hangup(kl->fdpty);
+		kl->stage++;
+		kl->expire = g_timeout_add_seconds(5, launch_expire, kl);
+		return FALSE;
+	}
+
+	if (!kl->gone) {
+		g_source_remove(kl->reap);
+		kl->reap = 0;
+		memset(&kl->ru, 0, sizeof(kl->ru));
+		kl->status = -1;
+		kl->gone = TRUE;
+		launch_finish(kl);
+	}
+	return FALSE;
+}
+
+
+GPid ktsuss_launch(KtsussAuth *auth, gchar **argv, KtsussOutputFunc output, KtsussExitFunc exited, gpointer data)
+{
+	KtsussLaunch *kl;
+	GIOChannel *chan;
+	const gchar *prompt;
+	int fdpty = -1;
+	pid_t pid;
+
+	if (!auth || !argv || !argv[0] || !ktsuss_get_backend())
+		return -1;
+
+	if ((pid = backend->spawn(auth->username, auth->password, argv, &fdpty, &prompt)) < 0)
+		return -1;
+
+	kl = g_new0(KtsussLaunch, 1);
+	kl->output = output;
+	kl->exited = exited;
+	kl->data = data;
+	kl->pid = pid;
+	kl->fdpty = fdpty;
+	if (prompt) {
+		prompt_init(&kl->scan, prompt);
+		kl->password = g_strdup(auth->password);
+		kl->timeout = g_timeout_add_seconds(PROMPT_TIMEOUT, launch_timeout, kl);
+	}
+
+	chan = g_io_channel_unix_new(fdpty);
+	g_io_add_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR, launch_output, kl);
+	g_io_channel_unref(chan);
+	kl->reap = g_timeout_add(20, launch_reap, kl);
+	if (limits_timeout())
+		kl->expire = g_timeout_add_seconds(limits_timeout(), launch_expire, kl);
+
+	return pid;
+}
+
+
+gboolean ktsuss_set_recording(const gchar *path, gsize buffer_size, gboolean compress)
+{
+	return recorder_setup(path, buffer_size, compress) == 0;
+}
+
+
+gboolean ktsuss_set_limit(const gchar *name, const gchar *value)
+{
+	return limits_set(name, value) == 0;
+}
+
+
+int ktsuss_check(KtsussAuth *auth)
+{
+	if (!ktsuss_get_backend())
+		return ERR_NO_BACKEND;
+	return backend->check(auth->username, auth->password);
+}
+
+
+int ktsuss_run(KtsussAuth *auth, gchar *command)
+{
+	int status;
+
+	memset(&run_rusage, 0, sizeof(run_rusage));
+	if (!ktsuss_get_backend())
+		return -1;
+	/* Up before the backend gets the password, a recorded session can't go unrecorded */
+	if (recorder_start() < 0)
+		return -1;
+	status = backend->run(auth->username, auth->password, command, &run_rusage);
+	recorder_stop();
+	return status;
+}
+
+
+const struct rusage *ktsuss_get_rusage(void)
+{
+	return &run_rusage;
+}
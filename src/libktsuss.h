@@ -0,0 +1,115 @@
+
+/* vim: set sw=4 sts=4 tw=80 */
+
+/*
+ * Copyright (c) 2011 , David B. Cortarello <dcortarello@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by David B. Cortarello.
+ * 4. Neither the name of David B. Cortarello nor the
+ *    names of its contributors may be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY DAVID B. CORTARELLO 'AS IS' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL DAVID B. CORTARELLO BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBKTSUSS_H
+#define LIBKTSUSS_H
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Credentials that already passed the backend check */
+typedef struct _KtsussAuth KtsussAuth;
+
+/* auth is NULL unless error is 0. It belongs to the caller, free it with ktsuss_auth_free() */
+typedef void (*KtsussAuthFunc)(KtsussAuth *auth, int error, gpointer data);
+/* Output of the launched command, as read from its terminal */
+typedef void (*KtsussOutputFunc)(const gchar *buf, gsize len, gpointer data);
+/* status is the wait(2) status of the backend process, or -1 if it outlived
+ * the "timeout" limit and wouldn't go away. ru is what it used */
+typedef void (*KtsussExitFunc)(int status, const struct rusage *ru, gpointer data);
+
+/* Pick the backend to use: "su", "sudo", "doas", or NULL/"auto" for the
+ * first usable one. Returns FALSE if it isn't built in or can't be used here */
+gboolean ktsuss_set_backend(const gchar *name);
+/* Name of the backend in use, detecting one if none was set. NULL if there's none */
+const gchar *ktsuss_get_backend(void);
+
+/* Ask for the password of username (or for both when username is NULL) on a
+ * dialog transient for parent, verify it without blocking the main loop and
+ * call callback with the outcome. message and title may be NULL */
+void ktsuss_authenticate_async(GtkWindow *parent, const gchar *username, const gchar *message,
+		const gchar *title, KtsussAuthFunc callback, gpointer data);
+
+/* Run argv as the authenticated user on a new pseudo terminal. sudo and doas
+ * get argv as it is, su gets it quoted into a single shell command. output gets
+ * everything the command prints and exited is called once it's gone and its
+ * output was delivered. Returns the backend pid, or -1 if it couldn't start */
+GPid ktsuss_launch(KtsussAuth *auth, gchar **argv, KtsussOutputFunc output, KtsussExitFunc exited, gpointer data);
+
+/* Verify the credentials with the backend again, blocking until it's done.
+ * Returns 0 or one of the errors ktsuss_strerror() knows about */
+int ktsuss_check(KtsussAuth *auth);
+
+/* Run command as the authenticated user relaying it to our own terminal,
+ * returns its wait(2) status */
+int ktsuss_run(KtsussAuth *auth, gchar *command);
+/* What the command of the last ktsuss_run() used, all zeroes if it didn't get
+ * to run or wasn't reaped */
+const struct rusage *ktsuss_get_rusage(void);
+
+/* Make every ktsuss_run() from now on record its session into path and its
+ * timing into path.timing, for scriptreplay -B path -T path.timing. Later
+ * sessions follow the first one in the same files. At most buffer_size bytes
+ * (0 for the default) wait in memory for the disk, more than that is
+ * dropped. compress gzips both files. Both files are created right
+ * away, FALSE is returned if they can't be or compression isn't built in, and
+ * ktsuss_run() returns -1 without running anything if the recording can't
+ * start. A NULL path stops recording */
+gboolean ktsuss_set_recording(const gchar *path, gsize buffer_size, gboolean compress);
+
+/* Scheduling and resource controls applied to the backend right before it
+ * runs the command, for both ktsuss_run() and ktsuss_launch(). name is one of
+ * "nice" (-20..19), "ionice" (realtime|best-effort|idle[:0..7]), "cpus"
+ * (list like 0,2-3), "limit" (as|core|cpu|data|fsize|nofile|nproc|stack|memlock=N),
+ * "cpu-timeout" (seconds of CPU) or "timeout" (wall clock seconds, then it
+ * gets SIGTERM and SIGKILL 5 seconds later, or a hangup when the backend
+ * runs it out of our reach). Returns FALSE if value makes no sense or it's
+ * not supported here */
+gboolean ktsuss_set_limit(const gchar *name, const gchar *value);
+
+KtsussAuth *ktsuss_auth_new(const gchar *username, const gchar *password);
+const gchar *ktsuss_auth_get_username(KtsussAuth *auth);
+const gchar *ktsuss_auth_get_password(KtsussAuth *auth);
+void ktsuss_auth_free(KtsussAuth *auth);
+
+const gchar *ktsuss_strerror(int error);
+void ktsuss_error_dialog(GtkWindow *parent, int error, const gchar *err_msg);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,370 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <err.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "recorder.h"
+
+/* The session goes to path (input and output, like script --log-io) and its
+ * timing to path.timing (like script --log-timing), so scriptreplay -B path
+ * -T path.timing plays it back. The relay only copies into a ring buffer, a
+ * writer thread takes it from there to disk, and what doesn't fit in the
+ * ring is dropped and counted instead of making the relay wait */
+
+/* Every chunk goes into the ring prefixed by this */
+typedef struct {
+	struct timespec ts;
+	uint32_t len;
+	char type;
+} RecordHeader;
+
+static size_t rec_size = RECORDER_DEFAULT_BUFFER;
+static int rec_compress = 0;
+
+static char *ring = NULL;
+/* Both only ever grow, the position in ring is taken modulo rec_size. head is
+ * written by the relay only and tail by the writer only */
+static size_t head = 0, tail = 0;
+static int stopping = 0;
+static unsigned long long dropped = 0;
+/* Written by the writer only, what it couldn't get into the files */
+static unsigned long long failed = 0;
+static int running = 0;
+/* The header goes in once, later sessions carry on in the same files */
+static int started = 0;
+static pthread_t writer;
+static struct timespec last;
+
+static FILE *data_fp = NULL, *timing_fp = NULL;
+#ifdef HAVE_LIBZ
+static gzFile data_gz = NULL, timing_gz = NULL;
+#endif
+
+
+/* Close the files and let go of the ring */
+static void recorder_close(void)
+{
+#ifdef HAVE_LIBZ
+	if (data_gz)
+		gzclose(data_gz);
+	if (timing_gz)
+		gzclose(timing_gz);
+	data_gz = timing_gz = NULL;
+#endif
+	if (data_fp)
+		fclose(data_fp);
+	if (timing_fp)
+		fclose(timing_fp);
+	data_fp = timing_fp = NULL;
+
+	free(ring);
+	ring = NULL;
+	started = 0;
+}
+
+
+/* The session has whatever was typed in it, so only we get to read it. An
+ * old recording we write over gets its mode fixed too, devices are left alone */
+static int open_private(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) >= 0 &&
+	    !fstat(fd, &st) && S_ISREG(st.st_mode))
+		fchmod(fd, 0600);
+	return fd;
+}
+
+
+static FILE *open_file(const char *path)
+{
+	FILE *fp;
+	int fd;
+
+	if ((fd = open_private(path)) < 0)
+		return NULL;
+	if ((fp = fdopen(fd, "w")) == NULL)
+		close(fd);
+	return fp;
+}
+
+
+#ifdef HAVE_LIBZ
+static gzFile open_gz(const char *path)
+{
+	gzFile gz;
+	int fd;
+
+	if ((fd = open_private(path)) < 0)
+		return NULL;
+	if ((gz = gzdopen(fd, "wb")) == NULL)
+		close(fd);
+	return gz;
+}
+#endif
+
+
+/* Record the sessions from now on into path, keeping at most buffer_size
+ * bytes in memory, until called again (a NULL path just stops recording).
+ * Everything that can fail is done here, before anybody authenticates, so a
+ * session that has to be recorded never runs unrecorded */
+int recorder_setup(const char *path, size_t buffer_size, int compress)
+{
+	char *timing_path;
+
+#ifndef HAVE_LIBZ
+	if (compress)
+		return -1;
+#endif
+	recorder_close();
+	if (!path)
+		return 0;
+
+	rec_size = buffer_size ? buffer_size : RECORDER_DEFAULT_BUFFER;
+	rec_compress = compress;
+
+	if ((ring = malloc(rec_size)) == NULL)
+		return -1;
+	if ((timing_path = malloc(strlen(path) + sizeof(".timing"))) == NULL) {
+		recorder_close();
+		return -1;
+	}
+	sprintf(timing_path, "%s.timing", path);
+
+#ifdef HAVE_LIBZ
+	if (rec_compress) {
+		data_gz = open_gz(path);
+		timing_gz = open_gz(timing_path);
+		free(timing_path);
+		if (!data_gz || !timing_gz) {
+			recorder_close();
+			return -1;
+		}
+		return 0;
+	}
+#endif
+	data_fp = open_file(path);
+	timing_fp = open_file(timing_path);
+	free(timing_path);
+	if (!data_fp || !timing_fp) {
+		recorder_close();
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Returns -1 if not all of buf made it */
+static int out_write(int timing, const void *buf, size_t len)
+{
+#ifdef HAVE_LIBZ
+	if (rec_compress)
+		return gzwrite(timing ? timing_gz : data_gz, buf, len) == (int)len ? 0 : -1;
+#endif
+	return fwrite(buf, 1, len, timing ? timing_fp : data_fp) == len ? 0 : -1;
+}
+
+
+static void ring_get(void *dst, size_t pos, size_t len)
+{
+	size_t off = pos % rec_size, first = rec_size - off;
+
+	if (first > len)
+		first = len;
+	memcpy(dst, ring + off, first);
+	memcpy((char *)dst + first, ring, len - first);
+}
+
+
+static void ring_put(size_t pos, const void *src, size_t len)
+{
+	size_t off = pos % rec_size, first = rec_size - off;
+
+	if (first > len)
+		first = len;
+	memcpy(ring + off, src, first);
+	memcpy(ring, (const char *)src + first, len - first);
+}
+
+
+/* Drain the ring to disk until the relay says it's done */
+static void *recorder_writer(void *arg)
+{
+	RecordHeader hdr;
+	char buf[4096], line[64];
+	size_t pos, h, n, done;
+	long sec, nsec;
+	int bad;
+	struct timespec nap = { 0, 5000000 };
+
+	for (;;) {
+		pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		if (pos == h) {
+			if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE) && h == __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+				break;
+			nanosleep(&nap, NULL);
+			continue;
+		}
+
+		ring_get(&hdr, pos, sizeof(hdr));
+		pos += sizeof(hdr);
+		bad = 0;
+		for (done = 0; done < hdr.len; done += n) {
+			n = hdr.len - done < sizeof(buf) ? hdr.len - done : sizeof(buf);
+			ring_get(buf, pos + done, n);
+			bad |= out_write(0, buf, n);
+		}
+		__atomic_store_n(&tail, pos + hdr.len, __ATOMIC_RELEASE);
+
+		sec = hdr.ts.tv_sec - last.tv_sec;
+		nsec = hdr.ts.tv_nsec - last.tv_nsec;
+		if (nsec < 0) {
+			sec--;
+			nsec += 1000000000L;
+		}
+		last = hdr.ts;
+		n = snprintf(line, sizeof(line), "%c %ld.%06ld %u\n", hdr.type, sec, nsec / 1000, (unsigned int)hdr.len);
+		/* A chunk that's only half there is as good as dropped */
+		if (out_write(1, line, n) < 0 || bad)
+			failed += hdr.len;
+	}
+	return arg;
+}
+
+
+/* Start the writer, does nothing unless recorder_setup() was called */
+int recorder_start(void)
+{
+	char line[64];
+	time_t now;
+
+	if (!ring || running)
+		return 0;
+
+	/* scriptreplay skips the first line, just like script writes one */
+	if (!started) {
+		now = time(NULL);
+		strftime(line, sizeof(line), "Script started on %Y-%m-%d %H:%M:%S%z\n", localtime(&now));
+		if (out_write(0, line, strlen(line)) < 0)
+			return -1;
+		started = 1;
+	}
+
+	head = tail = 0;
+	stopping = 0;
+	dropped = failed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	if (pthread_create(&writer, NULL, recorder_writer, NULL))
+		return -1;
+	running = 1;
+	return 0;
+}
+
+
+/* Called by the relay for everything it moves, type is 'I' or 'O'. Never blocks */
+void recorder_add(char type, const char *buf, size_t len)
+{
+	RecordHeader hdr;
+	size_t h;
+
+	if (!running || !len)
+		return;
+
+	h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	if (rec_size - (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) < sizeof(hdr) + len) {
+		dropped += len;
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	clock_gettime(CLOCK_MONOTONIC, &hdr.ts);
+	hdr.len = len;
+	hdr.type = type;
+	ring_put(h, &hdr, sizeof(hdr));
+	ring_put(h + sizeof(hdr), buf, len);
+	__atomic_store_n(&head, h + sizeof(hdr) + len, __ATOMIC_RELEASE);
+}
+
+
+/* Let the writer finish what's queued and get it all to disk. The files stay
+ * open for the next session, a failed try and the one after it (a stale cached
+ * password, say) go to the same recording */
+void recorder_stop(void)
+{
+	int flushed = 0;
+
+	if (!running)
+		return;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	running = 0;
+
+#ifdef HAVE_LIBZ
+	/* Ends the gzip member, the next session starts another one and zcat
+	 * reads them as one */
+	if (rec_compress && (gzflush(data_gz, Z_FINISH) != Z_OK || gzflush(timing_gz, Z_FINISH) != Z_OK))
+		flushed = -1;
+#endif
+	/* stdio holds on to some, it may only fail now or have failed quietly */
+	if (data_fp && (fflush(data_fp) || ferror(data_fp)))
+		flushed = -1;
+	if (timing_fp && (fflush(timing_fp) || ferror(timing_fp)))
+		flushed = -1;
+
+	if (dropped)
+		fprintf(stderr, "ktsuss: %llu bytes could not be recorded, the disk was too slow\n", dropped);
+	if (failed)
+		fprintf(stderr, "ktsuss: %llu bytes could not be written to the recording\n", failed);
+	if (flushed < 0)
+		warnx("The recording may be incomplete");
+	if (data_fp)
+		clearerr(data_fp);
+	if (timing_fp)
+		clearerr(timing_fp);
+	dropped = failed = 0;
+}
@@ -0,0 +1,380 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Throughput and latency benchmark for relay_pty(), the loop every backend
+ * uses to connect the elevated command to our terminal. A stand-in backend
+ * (this same program, with --stand-in) runs on the pty instead of su, so no
+ * password or privileges are involved. Every mode prints one line of
+ * key=value pairs:
+ *
+ *   stream  the stand-in writes --bytes of output as fast as it can
+ *   echo    --count keystrokes are sent one at a time and echoed back
+ *   mixed   keystrokes are echoed while the stand-in streams --bytes
+ *
+ * cpu and context switches are those of the relay process alone */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+
+#if defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+
+#include "util.h"
+
+#define CHUNK 65536
+#define KEY 'k'
+/* Tells the echoing stand-in to leave */
+#define QUIT 0x1d
+/* The stand-in says it's raw and ready */
+#define READY 'R'
+
+static unsigned long long bytes = 64ULL * 1024 * 1024;
+static int count = 2000;
+static char self[4096];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "write()");
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+
+/* What runs on the pty in place of su */
+static int stand_in(const char *mode)
+{
+	static char chunk[CHUNK];
+	struct termios raw;
+	unsigned long long left = bytes;
+	fd_set rfds;
+	char c;
+
+	memset(chunk, 'x', sizeof(chunk));
+
+	if (!strcmp(mode, "stream")) {
+		while (left) {
+			write_all(STDOUT_FILENO, chunk, left < CHUNK ? left : CHUNK);
+			left -= left < CHUNK ? left : CHUNK;
+		}
+		return 0;
+	}
+
+	/* No line discipline echo or buffering, we echo ourselves */
+	tcgetattr(STDIN_FILENO, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	c = READY;
+	write_all(STDOUT_FILENO, &c, 1);
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		FD_SET(STDIN_FILENO, &rfds);
+		/* Stream until --bytes are out, a relay starving input would never see a key otherwise */
+		if (!strcmp(mode, "mixed") && left) {
+			struct timeval tv = { 0, 0 };
+			if (select(STDIN_FILENO + 1, &rfds, NULL, NULL, &tv) < 0)
+				err(1, "select()");
+			if (!FD_ISSET(STDIN_FILENO, &rfds)) {
+				write_all(STDOUT_FILENO, chunk, left < 4096 ? left : 4096);
+				left -= left < 4096 ? left : 4096;
+				continue;
+			}
+		}
+		if (read(STDIN_FILENO, &c, 1) != 1 || c == QUIT)
+			return 0;
+		write_all(STDOUT_FILENO, &c, 1);
+	}
+}
+
+
+/* Start a relay between our pipes and a stand-in running mode */
+static pid_t start_relay(const char *mode, int *in, int *out, int *res)
+{
+	int pin[2], pout[2], pres[2], fdpty;
+	pid_t pid, sub;
+	struct rusage ru;
+
+	if (pipe(pin) || pipe(pout) || pipe(pres))
+		err(1, "pipe()");
+
+	if ((pid = fork()) < 0)
+		err(1, "fork()");
+	else if (pid == 0) {
+		dup2(pin[0], STDIN_FILENO);
+		dup2(pout[1], STDOUT_FILENO);
+		close(pin[0]); close(pin[1]);
+		close(pout[0]); close(pout[1]);
+		close(pres[0]);
+
+		if ((sub = forkpty(&fdpty, NULL, NULL, NULL)) < 0)
+			err(1, "forkpty()");
+		else if (sub == 0) {
+			execl(self, self, "--stand-in", mode, "--bytes", getenv("RELAY_BENCH_BYTES"), NULL);
+			err(1, "execl()");
+		}
+		relay_pty(sub, fdpty, NULL);
+		close(fdpty);
+
+		/* Only our own usage, the stand-in is not what we are measuring */
+		getrusage(RUSAGE_SELF, &ru);
+		write_all(pres[1], (char *)&ru, sizeof(ru));
+		_exit(0);
+	}
+
+	close(pin[0]);
+	close(pout[1]);
+	close(pres[1]);
+	*in = pin[1];
+	*out = pout[0];
+	*res = pres[0];
+	return pid;
+}
+
+
+/* Wait for the relay and print the line for this mode */
+static void report(const char *mode, pid_t pid, int res, double start, unsigned long long got, double *lat, int nlat)
+{
+	struct rusage ru;
+	double elapsed = now() - start, cpu;
+	ssize_t n;
+
+	memset(&ru, 0, sizeof(ru));
+	n = read(res, &ru, sizeof(ru));
+	close(res);
+	waitpid(pid, NULL, 0);
+	if (n != sizeof(ru))
+		errx(1, "%s: the relay didn't report its usage", mode);
+
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	printf("mode=%s seconds=%.3f bytes=%llu mb_per_s=%.2f", mode, elapsed, got, got / elapsed / 1e6);
+	if (nlat) {
+		qsort(lat, nlat, sizeof(double), cmp_double);
+		printf(" keys=%d p50_us=%.1f p99_us=%.1f", nlat, lat[nlat / 2] * 1e6, lat[nlat * 99 / 100] * 1e6);
+	}
+	/* Voluntary ones are the relay going to sleep, involuntary ones it being preempted */
+	printf(" cpu_s=%.3f cpu_pct=%.1f ctxsw_per_s=%.0f\n", cpu, cpu / elapsed * 100,
+			(ru.ru_nvcsw + ru.ru_nivcsw) / elapsed);
+	fflush(stdout);
+}
+
+
+static void bench_stream(void)
+{
+	static char buf[CHUNK];
+	unsigned long long got = 0;
+	int in, out, res;
+	double start = now();
+	pid_t pid;
+	ssize_t n;
+
+	pid = start_relay("stream", &in, &out, &res);
+	while ((n = read(out, buf, sizeof(buf))) > 0)
+		got += n;
+	close(in);
+	close(out);
+	report("stream", pid, res, start, got, NULL, 0);
+}
+
+
+/* Send count keystrokes one by one, timing each until it comes back */
+static void bench_keys(const char *mode)
+{
+	static char buf[CHUNK];
+	unsigned long long got = 0;
+	double *lat, start, sent;
+	int in, out, res, i, back;
+	char c = KEY, *ready;
+	pid_t pid;
+	ssize_t n, j;
+
+	if ((lat = calloc(count, sizeof(double))) == NULL)
+		err(1, "calloc()");
+
+	start = now();
+	pid = start_relay(mode, &in, &out, &res);
+
+	/* Typing before the stand-in is raw would get echoed by the pty too */
+	for (ready = NULL; !ready; ) {
+		if ((n = read(out, buf, sizeof(buf))) <= 0)
+			errx(1, "%s: the stand-in never got ready", mode);
+		if ((ready = memchr(buf, READY, n)) != NULL)
+			got += buf + n - ready - 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		sent = now();
+		write_all(in, &c, 1);
+		for (back = 0; !back; ) {
+			if ((n = read(out, buf, sizeof(buf))) <= 0)
+				errx(1, "%s: the relay went away", mode);
+			for (j = 0; j < n; j++)
+				if (buf[j] == KEY)
+					back = 1;
+				else
+					got++;
+		}
+		lat[i] = now() - sent;
+	}
+
+	c = QUIT;
+	write_all(in, &c, 1);
+	while ((n = read(out, buf, sizeof(buf))) > 0)
+		got += n;
+	close(in);
+	close(out);
+	report(mode, pid, res, start, got, lat, count);
+	free(lat);
+}
+
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [--bytes N] [--count N] [stream|echo|mixed]...\n", name);
+	printf("Benchmark the pty relay, all modes are run if none is given\n\n");
+	printf("\t--bytes N    Output written by the stand-in in stream mode, default 64M (K, M and G work)\n");
+	printf("\t--count N    Keystrokes sent in echo and mixed modes, default 2000\n");
+	exit(1);
+}
+
+
+static unsigned long long parse_size(const char *s)
+{
+	char *end;
+	unsigned long long n = strtoull(s, &end, 10);
+
+	switch (*end) {
+		case 'G': n *= 1024;
+			/* fall through */
+		case 'M': n *= 1024;
+			/* fall through */
+		case 'K': n *= 1024;
+	}
+	return n;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *stand_in_mode = NULL;
+	char num[32];
+	int i, ran = 0;
+	ssize_t n;
+
+	/* argv[0] is no path when we were found through PATH */
+	n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (n > 0)
+		self[n] = '\0';
+	else
+		snprintf(self, sizeof(self), "%s", argv[0]);
+
+	/* Keep our own output off the relay's pipe */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--stand-in") && i + 1 < argc)
+			stand_in_mode = argv[++i];
+		else if (!strcmp(argv[i], "--bytes") && i + 1 < argc)
+			bytes = parse_size(argv[++i]);
+		else if (!strcmp(argv[i], "--count") && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (argv[i][0] == '-')
+			usage(argv[0]);
+	}
+
+	if (stand_in_mode)
+		return stand_in(stand_in_mode);
+
+	if (count < 1)
+		usage(argv[0]);
+	snprintf(num, sizeof(num), "%llu", bytes);
+	setenv("RELAY_BENCH_BYTES", num, 1);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bytes") || !strcmp(argv[i], "--count")) {
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "stream"))
+			bench_stream();
+		else if (!strcmp(argv[i], "echo") || !strcmp(argv[i], "mixed"))
+			bench_keys(argv[i]);
+		else
+			usage(argv[0]);
+		ran = 1;
+	}
+
+	if (!ran) {
+		bench_stream();
+		bench_keys("echo");
+		bench_keys("mixed");
+	}
+	return 0;
+}
@@ -0,0 +1,283 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include "sched_limits.h"
+
+/* Scheduling and resource controls for the elevated command. Everything but
+ * the wall clock timeout is set in the backend's child right before it execs
+ * su, sudo or doas, and is inherited from there by the command. Only what an
+ * unprivileged process may do works: nice can only go up, limits only down,
+ * and pam_limits in the target's session may still override them */
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define MAX_RLIMITS 16
+
+static const struct {
+	const char *name;
+	int resource;
+} rlimit_names[] = {
+	{ "as", RLIMIT_AS },
+	{ "core", RLIMIT_CORE },
+	{ "cpu", RLIMIT_CPU },
+	{ "data", RLIMIT_DATA },
+	{ "fsize", RLIMIT_FSIZE },
+	{ "nofile", RLIMIT_NOFILE },
+	{ "nproc", RLIMIT_NPROC },
+	{ "stack", RLIMIT_STACK },
+#ifdef RLIMIT_MEMLOCK
+	{ "memlock", RLIMIT_MEMLOCK },
+#endif
+	{ NULL, 0 }
+};
+
+static const char *ioclass_names[] = { "none", "realtime", "best-effort", "idle", NULL };
+
+static int set_nice = 0, nice_level = 0;
+static int ioclass = 0, iolevel = 4;
+#ifdef __linux__
+static int set_cpus = 0;
+static cpu_set_t cpus;
+#endif
+static struct {
+	int resource;
+	rlim_t value;
+} rlimits[MAX_RLIMITS];
+static int nrlimits = 0;
+static unsigned int timeout = 0;
+
+
+static int parse_uint(const char *s, unsigned long *n)
+{
+	char *end;
+
+	/* strtoul() takes "-1" and blanks in front */
+	if (*s < '0' || *s > '9')
+		return -1;
+	errno = 0;
+	*n = strtoul(s, &end, 10);
+	return (errno || *end) ? -1 : 0;
+}
+
+
+static int add_rlimit(int resource, rlim_t value)
+{
+	int i;
+
+	for (i = 0; i < nrlimits && rlimits[i].resource != resource; i++)
+		;
+	if (i == MAX_RLIMITS)
+		return -1;
+	rlimits[i].resource = resource;
+	rlimits[i].value = value;
+	if (i == nrlimits)
+		nrlimits++;
+	return 0;
+}
+
+
+#ifdef __linux__
+/* Takes a list like taskset -c does: 0,2,4-7 */
+static int parse_cpus(const char *list)
+{
+	char *copy = strdup(list), *tok, *save = NULL, *dash;
+	unsigned long from, to;
+	int ret = 0;
+
+	CPU_ZERO(&cpus);
+	for (tok = strtok_r(copy, ",", &save); tok && !ret; tok = strtok_r(NULL, ",", &save)) {
+		if ((dash = strchr(tok, '-')) != NULL)
+			*dash++ = '\0';
+		if (parse_uint(tok, &from) < 0 || (dash ? parse_uint(dash, &to) : parse_uint(tok, &to)) < 0 || from > to || to >= CPU_SETSIZE)
+			ret = -1;
+		else
+			for (; from <= to; from++)
+				CPU_SET(from, &cpus);
+	}
+	free(copy);
+
+	if (!ret && !CPU_COUNT(&cpus))
+		ret = -1;
+	set_cpus = !ret;
+	return ret;
+}
+#endif
+
+
+/* Set one of the controls, name being nice, ionice, cpus, limit, cpu-timeout
+ * or timeout. Returns -1 if it doesn't make sense or isn't supported here */
+int limits_set(const char *name, const char *value)
+{
+	unsigned long n;
+	char *copy, *sep;
+	int i, ret = -1;
+
+	if (!strcmp(name, "nice")) {
+		n = strtol(value, &copy, 10);
+		if (*value && !*copy && (long)n >= -20 && (long)n <= 19) {
+			nice_level = (long)n;
+			set_nice = 1;
+			ret = 0;
+		}
+	}
+	else if (!strcmp(name, "ionice")) {
+#ifdef SYS_ioprio_set
+		/* CLASS[:LEVEL] */
+		copy = strdup(value);
+		if ((sep = strchr(copy, ':')) != NULL)
+			*sep++ = '\0';
+		for (i = 1; ioclass_names[i] && strcmp(ioclass_names[i], copy); i++)
+			;
+		if (ioclass_names[i] && (!sep || (parse_uint(sep, &n) == 0 && n <= 7))) {
+			ioclass = i;
+			iolevel = sep ? (int)n : 4;
+			ret = 0;
+		}
+		free(copy);
+#endif
+	}
+	else if (!strcmp(name, "cpus")) {
+#ifdef __linux__
+		ret = parse_cpus(value);
+#endif
+	}
+	else if (!strcmp(name, "limit")) {
+		/* RESOURCE=VALUE */
+		copy = strdup(value);
+		if ((sep = strchr(copy, '=')) != NULL) {
+			*sep++ = '\0';
+			for (i = 0; rlimit_names[i].name && strcmp(rlimit_names[i].name, copy); i++)
+				;
+			if (rlimit_names[i].name && parse_uint(sep, &n) == 0)
+				ret = add_rlimit(rlimit_names[i].resource, n);
+		}
+		free(copy);
+	}
+	else if (!strcmp(name, "cpu-timeout")) {
+		if (parse_uint(value, &n) == 0 && n)
+			ret = add_rlimit(RLIMIT_CPU, n);
+	}
+	else if (!strcmp(name, "timeout")) {
+		if (parse_uint(value, &n) == 0) {
+			timeout = n;
+			ret = 0;
+		}
+	}
+	return ret;
+}
+
+
+/* What goes wrong in the child can't be said on its terminal, the backend
+ * would read it as its prompt and the password could go in too early. It goes
+ * through a pipe instead, closed on exec so the parent knows when it's over */
+int limits_pipe(int pip[2])
+{
+	if (pipe(pip) < 0)
+		return -1;
+	fcntl(pip[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pip[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+
+/* Called in the backend's child just before exec, complaints go to errfd */
+void limits_apply(int errfd)
+{
+	struct rlimit rl;
+	rlim_t max;
+	int i;
+
+	if (set_nice && setpriority(PRIO_PROCESS, 0, nice_level) < 0)
+		dprintf(errfd, "ktsuss: could not set nice %d: %s\n", nice_level, strerror(errno));
+
+#ifdef SYS_ioprio_set
+	if (ioclass && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (ioclass << IOPRIO_CLASS_SHIFT) | iolevel) < 0)
+		dprintf(errfd, "ktsuss: could not set the I/O class: %s\n", strerror(errno));
+#endif
+
+#ifdef __linux__
+	if (set_cpus && sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		dprintf(errfd, "ktsuss: could not set the CPU affinity: %s\n", strerror(errno));
+#endif
+
+	for (i = 0; i < nrlimits; i++) {
+		if (getrlimit(rlimits[i].resource, &rl) < 0)
+			continue;
+		/* Past the soft CPU limit comes SIGXCPU, give it some seconds to clean up before SIGKILL */
+		max = rlimits[i].value + (rlimits[i].resource == RLIMIT_CPU ? 5 : 0);
+		if (rl.rlim_max == RLIM_INFINITY || max < rl.rlim_max)
+			rl.rlim_max = max;
+		rl.rlim_cur = rlimits[i].value < rl.rlim_max ? rlimits[i].value : rl.rlim_max;
+		if (setrlimit(rlimits[i].resource, &rl) < 0)
+			dprintf(errfd, "ktsuss: could not set a resource limit: %s\n", strerror(errno));
+	}
+}
+
+
+/* Called in the parent with the read end of limits_pipe(), passes on what the
+ * child had to say once it has exec'd or died */
+void limits_collect(int fd)
+{
+	char buf[512];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+		if (n > 0)
+			fwrite(buf, 1, n, stderr);
+	close(fd);
+}
+
+
+/* Wall clock seconds the command gets, 0 for forever */
+unsigned int limits_timeout(void)
+{
+	return timeout;
+}
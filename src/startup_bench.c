@@ -0,0 +1,251 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Startup benchmark for the backends: how long it takes each of them to
+ * check a password, and to run /bin/true as the target user from spawn to
+ * exit (prompt and password included). Unlike relay_bench this needs the real
+ * thing, so it has to run on a host where the backends are set up and the
+ * password of --user is known. It's read from $KTSUSS_BENCH_PASSWORD or, if
+ * that's not set, from the first line of stdin. Every backend and operation
+ * prints one line of key=value pairs, direct is a plain fork and exec of
+ * /bin/true on a pty, for reference */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#if defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+
+#include "errors.h"
+#include "util.h"
+#include "backend.h"
+
+static int count = 20;
+static char *user = "root";
+static char password[128];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static void report(const char *backend, const char *op, double *ms, int n)
+{
+	qsort(ms, n, sizeof(double), cmp_double);
+	printf("backend=%s op=%s runs=%d min_ms=%.2f p50_ms=%.2f p99_ms=%.2f max_ms=%.2f\n",
+			backend, op, n, ms[0], ms[n / 2], ms[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1], ms[n - 1]);
+	fflush(stdout);
+}
+
+
+/* Read the terminal until the command is gone */
+static int drain(pid_t pid, int fdpty)
+{
+	char buf[1024];
+	int status = 0;
+
+	while (read(fdpty, buf, sizeof(buf)) > 0)
+		;
+	close(fdpty);
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+
+/* /bin/true on a pty with nobody in between */
+static void bench_direct(void)
+{
+	double *ms = calloc(count, sizeof(double)), start;
+	int i, fdpty;
+	pid_t pid;
+
+	for (i = 0; i < count; i++) {
+		start = now();
+		if ((pid = forkpty(&fdpty, NULL, NULL, NULL)) < 0)
+			err(1, "forkpty()");
+		else if (pid == 0) {
+			execl("/bin/true", "true", NULL);
+			_exit(1);
+		}
+		drain(pid, fdpty);
+		ms[i] = (now() - start) * 1000;
+	}
+	report("direct", "run", ms, count);
+	free(ms);
+}
+
+
+static void bench_backend(const KtsussBackend *b)
+{
+	char *argv[2] = { "/bin/true", NULL };
+	double *check = calloc(count, sizeof(double)), *run = calloc(count, sizeof(double)), start;
+	const char *prompt;
+	int i, fdpty, error, status;
+	pid_t pid;
+
+	if (!b->probe(b->path)) {
+		printf("backend=%s error=\"not usable on this host\"\n", b->name);
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		start = now();
+		if ((error = b->check(user, password)) != ERR_SUCCESS) {
+			printf("backend=%s op=check error=\"%s\"\n", b->name, error > 0 ? KTS_ERRORS[error] : "signaled");
+			goto out;
+		}
+		check[i] = (now() - start) * 1000;
+	}
+	report(b->name, "check", check, count);
+
+	for (i = 0; i < count; i++) {
+		start = now();
+		if ((pid = b->spawn(user, password, argv, &fdpty, &prompt)) < 0 || pty_login(pid, fdpty, prompt, password, -1) < 0) {
+			printf("backend=%s op=run error=\"could not start\"\n", b->name);
+			goto out;
+		}
+		status = drain(pid, fdpty);
+		run[i] = (now() - start) * 1000;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			printf("backend=%s op=run error=\"exit status %d\"\n", b->name, status);
+			goto out;
+		}
+	}
+	report(b->name, "run", run, count);
+
+out:
+	free(check);
+	free(run);
+}
+
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [--count N] [--user USER] [su|sudo|doas]...\n", name);
+	printf("Benchmark backend startup, every compiled in backend is run if none is given\n\n");
+	printf("\t--count N    Runs of every operation, default 20\n");
+	printf("\t--user USER  Target user, default root\n");
+	exit(1);
+}
+
+
+/* Get the password without showing it */
+static void read_password(void)
+{
+	struct termios t, quiet;
+	const char *env;
+	int tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &t) == 0;
+
+	if ((env = getenv("KTSUSS_BENCH_PASSWORD")) != NULL) {
+		snprintf(password, sizeof(password), "%s", env);
+		return;
+	}
+
+	if (tty) {
+		fprintf(stderr, "Password for %s: ", user);
+		quiet = t;
+		quiet.c_lflag &= ~ECHO;
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+	}
+	if (!fgets(password, sizeof(password), stdin))
+		*password = '\0';
+	password[strcspn(password, "\n")] = '\0';
+	if (tty) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+		fprintf(stderr, "\n");
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	const KtsussBackend *b;
+	char names[64], *name;
+	int i, ran = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--count") && i + 1 < argc)
+			count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--user") && i + 1 < argc)
+			user = argv[++i];
+		else if (argv[i][0] == '-' || !backend_find(argv[i]))
+			usage(argv[0]);
+	}
+	if (count < 1)
+		usage(argv[0]);
+
+	read_password();
+	bench_direct();
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--count") || !strcmp(argv[i], "--user")) {
+			i++;
+			continue;
+		}
+		bench_backend(backend_find(argv[i]));
+		ran = 1;
+	}
+
+	if (!ran) {
+		snprintf(names, sizeof(names), "%s", backend_list());
+		for (name = strtok(names, ", "); name; name = strtok(NULL, ", "))
+			if ((b = backend_find(name)) != NULL)
+				bench_backend(b);
+	}
+
+	memset(password, '\0', sizeof(password));
+	return 0;
+}
@@ -50,16 +50,19 @@
 #include <utmp.h>
 #endif
 #include <termios.h>
+#include <err.h>
+#include <signal.h>
+#include <sys/select.h>
 
 #include "errors.h"
-
-#ifndef MAX
-#define MAX(a,b) ((a)>(b)?(a):(b))
-#endif
+#include "util.h"
+#include "sched_limits.h"
+#include "su_backend.h"
 
 #define BUFF_SIZE 1024
 
-static struct termios orig_termios;
+/* su translates its prompt, any line ending in a colon will do */
+#define SU_PROMPT ""
 
 /* Finalize the su call */
 static void end_su(int fd)
@@ -73,150 +76,133 @@ static void end_su(int fd)
 	tv.tv_usec = 100;
 	FD_ZERO(&rfds);
 	FD_SET(fd, &rfds);
-	if (select(fd+1, &rfds, NULL, NULL, &tv) < 0)
-		err(1, "select()");
-	if (FD_ISSET(fd, &rfds))
+	if (select(fd+1, &rfds, NULL, NULL, &tv) > 0)
 		read(fd, buf, BUFF_SIZE);
 }
 
 
-/* Finalize the su call */
-static int init_su(int *fdpty, const char *username, const char *password, char *cmd[])
+/* Start su on a new terminal, the scheduling and resource controls only go
+ * to the real command (run), not to the check */
+static pid_t init_su(int *fdpty, char *cmd[], int run, const char **prompt)
 {
-	int status = 1, i = 0;
-	char buf[BUFF_SIZE];
+	int errpipe[2];
 	pid_t pid;
-	fd_set rfds;
-	struct timeval tv;
+
+	if (run && limits_pipe(errpipe) < 0) {
+		warn("pipe()");
+		return -1;
+	}
 
 	/* Creates a new terminal */
-	if ((pid = forkpty(fdpty, NULL, NULL, NULL)) < 0) err(1, "forkpty()");
+	if ((pid = forkpty(fdpty, NULL, NULL, NULL)) < 0) {
+		warn("forkpty()");
+		if (run) {
+			close(errpipe[0]);
+			close(errpipe[1]);
+		}
+		return -1;
+	}
 	else if (pid == 0) {
 		setsid();
-		signal(SIGHUP, SIG_IGN);
+		/* Only the check may outlive its terminal, the command has to go
+		 * when we hang up on it */
+		if (run)
+			limits_apply(errpipe[1]);
+		else
+			signal(SIGHUP, SIG_IGN);
 		execv(cmd[0], cmd);
-		err(1, "execv()");
-		exit(1);
-	}
-
-	/* Read the "Password:" prompt */
-	for (i = 500; i && status; i--) {
-		tv.tv_sec = 0;
-		tv.tv_usec = 10;
-		FD_ZERO(&rfds);
-		FD_SET(*fdpty, &rfds);
-		if (select(*fdpty + 1, &rfds, NULL, NULL, &tv) < 0)
-			err(1, "select()");
-		if (FD_ISSET(*fdpty, &rfds)) {
-			read(*fdpty, buf, BUFF_SIZE - 1);
-			status = 0;
-		}
-		usleep(1000);
+		warn("execv()");
+		_exit(1);
 	}
 
-	/* Check if we got a limit time */
-	if (status) {
-		kill(pid, SIGKILL);
-		err(1, "No prompt given by the su command");
+	if (run) {
+		close(errpipe[1]);
+		limits_collect(errpipe[0]);
 	}
 
-	/* Send the password */
-	snprintf(buf, 64, "%s\n", password);
-	write(*fdpty, buf, strlen(buf));
-
-	/* Read what's left in the buffers */
-	end_su(*fdpty);
-
+	/* su doesn't ask root for any password */
+	*prompt = getuid() ? SU_PROMPT : NULL;
 	return pid;
 }
 
 
-/* Check user and password */
-int check_password_su(const char *username, const char *password)
+/* Start checking user and password, the check is done once the returned pid exits */
+pid_t spawn_check_su(const char *username, const char *password, int *fdpty, const char **prompt)
 {
-	int fdpty = 0, status = 0, pid = 0;
 #if defined(__FreeBSD__)
 	char *cmd[6] = { SUPATH, (char *)username, "-m", "-c", "exit", NULL };
 #else
 	char *cmd[6] = { SUPATH, (char *)username, "-p", "-c", "exit", NULL };
 #endif
 
-	pid = init_su(&fdpty, username, password, cmd);
+	return init_su(fdpty, cmd, 0, prompt);
+}
+
+
+/* Check user and password */
+int check_password_su(const char *username, const char *password)
+{
+	int fdpty = 0, status = 0, pid = 0;
+	const char *prompt;
+
+	if ((pid = spawn_check_su(username, password, &fdpty, &prompt)) < 0)
+		return ERR_CALLING_SU;
+	if (pty_login(pid, fdpty, prompt, password, -1) < 0)
+		return ERR_CALLING_SU;
 
 	waitpid(pid, &status, 0);
 
 	end_su(fdpty);
 	close(fdpty);
 
-	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-		return ERR_SUCCESS;
-	else
-		if (WIFSIGNALED(status)) {
-			fprintf(stderr, "Why I was signaled?: %d\n", WTERMSIG(status));
-			return -1;
-		}
-	return ERR_WRONG_USER_OR_PASSWD;
+	return check_status(status);
 }
 
 
-/* Run the given command as the given user */
-void run_su(char *username, char *password, char *command)
+/* Start argv as the given user on a new terminal, su wants it as a single shell command */
+pid_t spawn_su(const char *username, const char *password, char **argv, int *fdpty, const char **prompt)
 {
 #if defined(__FreeBSD__)
-	char buf[BUFF_SIZE], *cmd[6] = { SUPATH, username, "-m", "-c", command, NULL };
+	char *cmd[6] = { SUPATH, (char *)username, "-m", "-c", NULL, NULL };
 #else
-	char buf[BUFF_SIZE], *cmd[6] = { SUPATH, username, "-p", "-c", command, NULL };
+	char *cmd[6] = { SUPATH, (char *)username, "-p", "-c", NULL, NULL };
 #endif
-	int fdpty = 0, status = 0, tty = 1;
-	pid_t pid = 0;
-	fd_set rfds;
-	struct timeval tv;
-
-	pid = init_su(&fdpty, username, password, cmd);
-
-	/* Put the terminal in raw mode */
-	if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) {
-		if (errno == ENOTTY)
-			errno = tty = 0;
-		else
-			err(1, "tcgetattr()");
-	}
+	pid_t pid;
 
-	if (tty)
-		tty_raw(STDIN_FILENO);
+	if ((cmd[4] = shell_join(argv)) == NULL)
+		return -1;
+	pid = init_su(fdpty, cmd, 1, prompt);
+	free(cmd[4]);
+	return pid;
+}
 
-	while (1) {
-		waitpid(pid, &status, WNOHANG);
 
-		/* Ok, the program needs some interaction, so this will do it fine */
-		tv.tv_sec = 0;
-		tv.tv_usec = 10;
-		FD_ZERO(&rfds);
-		FD_SET(fdpty, &rfds);
-		FD_SET(STDIN_FILENO, &rfds);
+/* Run the given command as the given user */
+int run_su(char *username, char *password, char *command, struct rusage *ru)
+{
+	int fdpty = 0, status = 0;
+	pid_t pid = 0;
+	const char *prompt;
+#if defined(__FreeBSD__)
+	char *cmd[6] = { SUPATH, username, "-m", "-c", command, NULL };
+#else
+	char *cmd[6] = { SUPATH, username, "-p", "-c", command, NULL };
+#endif
 
-		if (select(MAX(fdpty, STDIN_FILENO)+1, &rfds, NULL, NULL, &tv) < 0) err(1, "select()");
+	if ((pid = init_su(&fdpty, cmd, 1, &prompt)) < 0)
+		return -1;
+	if (pty_login(pid, fdpty, prompt, password, STDOUT_FILENO) < 0)
+		return -1;
 
-		if (FD_ISSET(fdpty, &rfds)) {
-			if ((status = read(fdpty, buf, BUFF_SIZE)) > 0)
-				write(STDOUT_FILENO, buf, status);
-			else
-				break;
+	/* Read what's left in the buffers */
+	end_su(fdpty);
 
-		}
-		else if (FD_ISSET(STDIN_FILENO, &rfds)) {
-			status = read(STDIN_FILENO, buf, BUFF_SIZE);
-			write(fdpty, buf, status);
-		}
-		usleep(100);
-	}
+	status = relay_pty(pid, fdpty, ru);
 
 	end_su(fdpty);
 	close(fdpty);
 
-	if (tty)
-	    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) < 0) 
-			err(1, "tcsetattr()");
+	return status;
 }
 
 #endif
@@ -34,7 +34,13 @@
 #ifndef SU_BACKEND_H
 #define SU_BACKEND_H
 
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+pid_t spawn_check_su(const char *username, const char *password, int *fdpty, const char **prompt);
 int check_password_su(const char *username, const char *password);
-void run_su(char *username, char *password, char *command);
+pid_t spawn_su(const char *username, const char *password, char **argv, int *fdpty, const char **prompt);
+int run_su(char *username, char *password, char *command, struct rusage *ru);
 
 #endif
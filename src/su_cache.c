@@ -0,0 +1,176 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "config.h"
+#include "su_cache.h"
+#ifdef HAVE_SU_CACHE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/keyctl.h>
+
+/* Possessor permissions, libkeyutils is not around to give us these */
+#define KEY_POS_VIEW    0x01000000
+#define KEY_POS_READ    0x02000000
+#define KEY_POS_WRITE   0x04000000
+#define KEY_POS_SEARCH  0x08000000
+#define KEY_POS_SETATTR 0x20000000
+#define KTS_KEY_PERM (KEY_POS_VIEW | KEY_POS_READ | KEY_POS_WRITE | KEY_POS_SEARCH | KEY_POS_SETATTR)
+
+#define KTS_KEYRING "ktsuss"
+
+typedef int key_serial_t;
+
+static key_serial_t add_key(const char *type, const char *desc, const void *payload, size_t plen, key_serial_t ring)
+{
+	return syscall(SYS_add_key, type, desc, payload, plen, ring);
+}
+
+static long keyctl(int cmd, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5)
+{
+	return syscall(SYS_keyctl, cmd, arg2, arg3, arg4, arg5);
+}
+
+
+/* Builds the key description, bound to our uid, login session and target user */
+static void su_cache_desc(char *desc, size_t len, const char *username)
+{
+	FILE *fp;
+	unsigned int session = 0;
+
+	/* The audit session id survives setsid(), so every terminal and launcher of the login shares it */
+	if ((fp = fopen("/proc/self/sessionid", "r")) != NULL) {
+		if (fscanf(fp, "%u", &session) != 1)
+			session = 0;
+		fclose(fp);
+	}
+	snprintf(desc, len, "ktsuss:%u:%u:%s", (unsigned int)getuid(), session, username);
+}
+
+
+/* Gets our private keyring inside the session keyring, creating it if asked to */
+static key_serial_t su_cache_keyring(int create)
+{
+	key_serial_t ring;
+
+	/* Without a real session keyring the kernel would hand us a throwaway one, so don't bother */
+	if (keyctl(KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, 0, 0, 0) < 0)
+		return -1;
+
+	ring = keyctl(KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING, (unsigned long)"keyring", (unsigned long)KTS_KEYRING, 0);
+	if (ring < 0 && create) {
+		if ((ring = add_key("keyring", KTS_KEYRING, NULL, 0, KEY_SPEC_SESSION_KEYRING)) < 0)
+			return -1;
+		keyctl(KEYCTL_SETPERM, ring, KTS_KEY_PERM, 0, 0);
+	}
+	return ring;
+}
+
+
+/* Look for a cached password for username, returns 1 and fills password if found */
+int su_cache_lookup(const char *username, char *password, size_t len)
+{
+	char desc[256];
+	key_serial_t ring, key;
+	long n;
+
+	if ((ring = su_cache_keyring(0)) < 0)
+		return 0;
+
+	su_cache_desc(desc, sizeof(desc), username);
+	if ((key = keyctl(KEYCTL_SEARCH, ring, (unsigned long)"user", (unsigned long)desc, 0)) < 0)
+		return 0;
+
+	n = keyctl(KEYCTL_READ, key, (unsigned long)password, len - 1, 0);
+	if (n < 0 || (size_t)n >= len) {
+		memset(password, '\0', len);
+		return 0;
+	}
+	password[n] = '\0';
+	return 1;
+}
+
+
+/* Cache an already verified password for username during ttl seconds. su only
+ * takes the real password, so that's what is kept: any process of the login
+ * session possesses the keyring and can read it back while the key lives */
+void su_cache_store(const char *username, const char *password, unsigned int ttl)
+{
+	char desc[256];
+	key_serial_t ring, key;
+
+	if (!ttl || (ring = su_cache_keyring(1)) < 0)
+		return;
+
+	su_cache_desc(desc, sizeof(desc), username);
+	if ((key = add_key("user", desc, password, strlen(password), ring)) < 0)
+		return;
+
+	keyctl(KEYCTL_SETPERM, key, KTS_KEY_PERM, 0, 0);
+	keyctl(KEYCTL_SET_TIMEOUT, key, ttl, 0, 0);
+}
+
+
+/* Drop the cached password for username, it stopped working */
+void su_cache_drop(const char *username)
+{
+	char desc[256];
+	key_serial_t ring, key;
+
+	if ((ring = su_cache_keyring(0)) < 0)
+		return;
+
+	su_cache_desc(desc, sizeof(desc), username);
+	if ((key = keyctl(KEYCTL_SEARCH, ring, (unsigned long)"user", (unsigned long)desc, 0)) < 0)
+		return;
+	keyctl(KEYCTL_REVOKE, key, 0, 0, 0);
+	keyctl(KEYCTL_UNLINK, key, ring, 0, 0);
+}
+
+
+/* Drop every cached password of this session */
+void su_cache_forget(void)
+{
+	key_serial_t ring;
+
+	if ((ring = su_cache_keyring(0)) < 0)
+		return;
+
+	/* Revoking the keyring takes every key linked in it along */
+	keyctl(KEYCTL_REVOKE, ring, 0, 0, 0);
+	keyctl(KEYCTL_UNLINK, ring, KEY_SPEC_SESSION_KEYRING, 0, 0);
+}
+
+#endif
@@ -51,27 +51,30 @@
 
 #include <termios.h>
 #include <fcntl.h>
+#include <err.h>
 
 #include "errors.h"
+#include "util.h"
+#include "sched_limits.h"
+#include "sudo_backend.h"
 
-#ifndef MAX
-#define MAX(a,b) ((a)>(b)?(a):(b))
-#endif
-
-#define BUFF_SIZE 1024
-
-static struct termios orig_termios;
-
-/* Check user and password */
-int check_password_sudo(const char *username, const char *password)
+/* Start checking user and password, the check is done once the returned pid exits */
+pid_t spawn_check_sudo(const char *username, const char *password, int *fdpty, const char **prompt)
 {
 	int status = 0, pid = 0, pip[2];
 	char *cmd[10] = { SUDOPATH, "-u", (char *)username, "-k", "-S", "-p", "", "-E", "true", NULL };
-	char pass[64];
 
-	if (pipe(pip)) err(1, "pipe()");
+	if (pipe(pip) < 0) {
+		warn("pipe()");
+		return -1;
+	}
 
-	if ((pid = fork()) < 0) err(1, "fork()");
+	if ((pid = fork()) < 0) {
+		warn("fork()");
+		close(pip[0]);
+		close(pip[1]);
+		return -1;
+	}
 	else if (pid == 0) {
 		close(pip[1]);
 		status = open("/dev/null", O_WRONLY);
@@ -79,97 +82,122 @@ int check_password_sudo(const char *username, const char *password)
 		close(status);
 		dup2(pip[0], STDIN_FILENO);
 		execv(cmd[0], cmd);
-		close(pip[0]);
-		err(1, "execv()");
+		_exit(1);
 	}
 	close(pip[0]);
-	sprintf(pass, "%s\n", password);
-	write(pip[1], pass, strlen(pass));
+	pty_send_password(pip[1], password);
 	close(pip[1]);
+
+	/* sudo gets the password through a pipe, there's no terminal to keep nor prompt to wait for */
+	*fdpty = -1;
+	*prompt = NULL;
+	return pid;
+}
+
+
+/* Check user and password */
+int check_password_sudo(const char *username, const char *password)
+{
+	int status = 0, pid = 0, fdpty;
+	const char *prompt;
+
+	if ((pid = spawn_check_sudo(username, password, &fdpty, &prompt)) < 0)
+		return ERR_CALLING_SU;
 	
 	waitpid(pid, &status, 0);
-	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-		return ERR_SUCCESS;
-	else
-		if (WIFSIGNALED(status)) {
-			fprintf(stderr, "Why I was signaled?: %d\n", WTERMSIG(status));
-			return -1;
-		}
-	return ERR_WRONG_USER_OR_PASSWD;
+
+	return check_status(status);
 }
 
 
-/* Run the given command as the given user */
-void run_sudo(char *username, char *password, char *command)
+/* Start sudo on a new terminal, reading the password from a pipe */
+static pid_t init_sudo(const char *password, char *cmd[], int *fdpty)
 {
-	char buf[BUFF_SIZE], *cmd[10] = { SUDOPATH, "-u", (char *)username, "-k", "-S", "-p", "", "-E", command, NULL };
-	int fdpty = 0, status = 0, tty = 1, i = 0;
-	int pip[2];
+	int pip[2], errpipe[2];
 	pid_t pid;
-	fd_set rfds;
-	struct timeval tv;
-
-	char pass[64];
 
-	if (pipe(pip)) err(1, "pipe()");
+	if (pipe(pip) < 0) {
+		warn("pipe()");
+		return -1;
+	}
+	if (limits_pipe(errpipe) < 0) {
+		warn("pipe()");
+		close(pip[0]);
+		close(pip[1]);
+		return -1;
+	}
 
 	/* Creates a new terminal */
-	if ((pid = forkpty(&fdpty, NULL, NULL, NULL)) < 0) err(1, "forkpty()");
+	if ((pid = forkpty(fdpty, NULL, NULL, NULL)) < 0) {
+		warn("forkpty()");
+		close(pip[0]);
+		close(pip[1]);
+		close(errpipe[0]);
+		close(errpipe[1]);
+		return -1;
+	}
 	else if (pid == 0) {
 		setsid();
 
 		close(pip[1]);
 		dup2(pip[0], STDIN_FILENO);
+		limits_apply(errpipe[1]);
 		execv(cmd[0], cmd);
 		close(pip[0]);
 
-		err(1, "execv()");
-		exit(1);
+		warn("execv()");
+		_exit(1);
 	}
 
-    close(pip[0]);
-    sprintf(pass, "%s\n", password);
-    write(pip[1], pass, strlen(pass));
-    close(pip[1]);
-
-	/* Put the terminal in raw mode */
-	if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) {
-		if (errno == ENOTTY)
-			errno = tty = 0;
-		else
-			err(1, "tcgetattr()");
-	}
-	if (tty)
-		tty_raw(STDIN_FILENO);
-
-	/*read(fdpty, buf, BUFF_SIZE);*/
-	while (!waitpid(pid, &status, WNOHANG)) {
-
-		/* Ok, the program needs some interaction, so this will do it fine */
-		tv.tv_sec = 0;
-		tv.tv_usec = 10;
-		FD_ZERO(&rfds);
-		FD_SET(fdpty, &rfds);
-		FD_SET(STDIN_FILENO, &rfds);
-
-		if (select(MAX(fdpty, STDIN_FILENO)+1, &rfds, NULL, NULL, &tv) < 0) err(1, "select()");
-
-		if (FD_ISSET(fdpty, &rfds)) {
-			status = read(fdpty, buf, BUFF_SIZE);
-			write(STDOUT_FILENO, buf, status);
-		}
-		else if (FD_ISSET(STDIN_FILENO, &rfds)) {
-			status = read(STDIN_FILENO, buf, BUFF_SIZE);
-			write(fdpty, buf, status);
-		}
-		usleep(100);
-	}
+	close(errpipe[1]);
+	limits_collect(errpipe[0]);
+
+	close(pip[0]);
+	pty_send_password(pip[1], password);
+	close(pip[1]);
+
+	return pid;
+}
+
+
+/* Start argv as the given user on a new terminal, sudo takes it as it is */
+pid_t spawn_sudo(const char *username, const char *password, char **argv, int *fdpty, const char **prompt)
+{
+	char *head[9] = { SUDOPATH, "-u", (char *)username, "-k", "-S", "-p", "", "-E", "--" };
+	char **cmd;
+	pid_t pid;
+	int n;
+
+	for (n = 0; argv[n]; n++)
+		;
+	if ((cmd = malloc((9 + n + 1) * sizeof(char *))) == NULL)
+		return -1;
+	memcpy(cmd, head, sizeof(head));
+	memcpy(cmd + 9, argv, (n + 1) * sizeof(char *));
+
+	pid = init_sudo(password, cmd, fdpty);
+	free(cmd);
+
+	*prompt = NULL;
+	return pid;
+}
+
+
+/* Run the given command as the given user */
+int run_sudo(char *username, char *password, char *command, struct rusage *ru)
+{
+	char *cmd[10] = { SUDOPATH, "-u", username, "-k", "-S", "-p", "", "-E", command, NULL };
+	int fdpty = 0, status = 0;
+	pid_t pid;
+
+	if ((pid = init_sudo(password, cmd, &fdpty)) < 0)
+		return -1;
+
+	status = relay_pty(pid, fdpty, ru);
 
 	close(fdpty);
 
-	if (tty)
-	    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) < 0) 
-			err(1, "tcsetattr()");
+	return status;
 }
 
 #endif
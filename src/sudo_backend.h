@@ -33,8 +33,14 @@
 
 #ifndef SUDO_BACKEND_H
 
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+pid_t spawn_check_sudo(const char *username, const char *password, int *fdpty, const char **prompt);
 int check_password_sudo(const char *username, const char *password);
-void run_sudo(char *username, char *password, char *command);
+pid_t spawn_sudo(const char *username, const char *password, char **argv, int *fdpty, const char **prompt);
+int run_sudo(char *username, char *password, char *command, struct rusage *ru);
 
 #define SUDO_BACKEND_H
 
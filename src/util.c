@@ -0,0 +1,397 @@
+
+/* vim: set sw=4 sts=4 : */
+
+/*
+ * Copyright (c) 2007-2011, David B. Cortarello
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice
+ *     and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice
+ *     and the following disclaimer in the documentation and/or other materials
+ *     provided with the distribution.
+ *   * Neither the name of Kwort nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include <termios.h>
+
+#include "errors.h"
+#include "util.h"
+#include "recorder.h"
+#include "sched_limits.h"
+
+#ifndef MAX
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#endif
+
+#define BUFF_SIZE 1024
+
+static struct termios orig_termios;
+
+/* Set the terminal in raw mode (ttyfd must be a valid terminal file descriptor) */
+void tty_raw(int ttyfd)
+{
+	struct termios raw;
+
+	memcpy(&raw, &orig_termios, sizeof(struct termios));
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= (CS8);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 5; raw.c_cc[VTIME] = 8;
+    raw.c_cc[VMIN] = 0; raw.c_cc[VTIME] = 0;
+    raw.c_cc[VMIN] = 2; raw.c_cc[VTIME] = 0;
+    raw.c_cc[VMIN] = 0; raw.c_cc[VTIME] = 8;
+    if (tcsetattr(ttyfd, TCSAFLUSH, &raw) < 0) 
+		err(1, "tcsetattr()");
+}
+
+
+/* Hang up the backend's terminal. Whatever runs on it gets SIGHUP from the
+ * kernel, which works even when the command runs as root and kill() doesn't */
+void pty_hangup(int fdpty)
+{
+	int fd;
+
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(fd, fdpty);
+		close(fd);
+	}
+}
+
+
+/* Give pid a few seconds to go away, it may be out of our reach. Returns 1 if
+ * it was reaped */
+static int reap(pid_t pid, int *status, struct rusage *ru)
+{
+	pid_t gone = 0;
+	int i;
+
+	for (i = 0; i < 500 && (gone = wait4(pid, status, WNOHANG, ru)) == 0; i++)
+		usleep(10000);
+	return gone > 0;
+}
+
+
+/* Relay our terminal to the backend's one until it's done, returns its wait
+ * status, or -1 if it outlived the timeout and didn't go away when killed.
+ * What it used goes to ru if it's not NULL, zeroes if it wasn't reaped */
+int relay_pty(pid_t pid, int fdpty, struct rusage *ru)
+{
+	char buf[BUFF_SIZE];
+	int status = 0, tty = 1;
+	fd_set rfds;
+	struct timeval tv;
+	struct timespec start, now;
+	struct rusage own;
+	unsigned int timeout = limits_timeout();
+	int killed = 0;
+	long elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Put the terminal in raw mode */
+	if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) {
+		if (errno == ENOTTY)
+			errno = tty = 0;
+		else
+			err(1, "tcgetattr()");
+	}
+
+	if (tty)
+		tty_raw(STDIN_FILENO);
+
+	while (1) {
+		/* Out of time: ask nicely, then don't */
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+			if (!killed && elapsed >= timeout * 1000L) {
+				fprintf(stderr, "\r\nktsuss: %u seconds are up, terminating the command\r\n", timeout);
+				/* The backend may be out of our reach (doas runs the command as root) */
+				if (kill(pid, SIGTERM) < 0)
+					pty_hangup(fdpty);
+				killed = 1;
+			}
+			else if (killed && elapsed >= (timeout + 5) * 1000L) {
+				if (kill(pid, SIGKILL) < 0)
+					pty_hangup(fdpty);
+				break;
+			}
+		}
+
+		/* Ok, the program needs some interaction, so this will do it fine */
+		tv.tv_sec = 0;
+		tv.tv_usec = 10;
+		FD_ZERO(&rfds);
+		FD_SET(fdpty, &rfds);
+		FD_SET(STDIN_FILENO, &rfds);
+
+		if (select(MAX(fdpty, STDIN_FILENO)+1, &rfds, NULL, NULL, &tv) < 0) err(1, "select()");
+
+		if (FD_ISSET(fdpty, &rfds)) {
+			if ((status = read(fdpty, buf, BUFF_SIZE)) > 0) {
+				write(STDOUT_FILENO, buf, status);
+				recorder_add('O', buf, status);
+			}
+			else
+				break;
+
+		}
+		else if (FD_ISSET(STDIN_FILENO, &rfds)) {
+			status = read(STDIN_FILENO, buf, BUFF_SIZE);
+			write(fdpty, buf, status);
+			if (status > 0)
+				recorder_add('I', buf, status);
+		}
+		usleep(100);
+	}
+
+	if (tty)
+	    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) < 0) 
+			err(1, "tcsetattr()");
+
+	status = 0;
+	if (!ru)
+		ru = &own;
+	memset(ru, 0, sizeof(*ru));
+	if (!killed)
+		wait4(pid, &status, 0, ru);
+	else {
+		/* Don't hang forever on something we couldn't kill */
+		if (!reap(pid, &status, ru)) {
+			warnx("The command is still running, leaving it behind");
+			status = -1;
+		}
+	}
+	return status;
+}
+
+
+/* Translate the wait status of a password check into one of our errors */
+int check_status(int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return ERR_SUCCESS;
+	else
+		if (WIFSIGNALED(status)) {
+			fprintf(stderr, "Why I was signaled?: %d\n", WTERMSIG(status));
+			return -1;
+		}
+	return ERR_WRONG_USER_OR_PASSWD;
+}
+
+
+/* Start looking for a prompt: the line being typed ends with ':' and has
+ * match in it. su translates its prompt, so su asks for "" and takes any.
+ * A match starting with '^' has to be the first thing on the terminal, so a
+ * backend that didn't ask can't have the command's output taken for it */
+void prompt_init(PromptScan *ps, const char *match)
+{
+	ps->anchored = (*match == '^');
+	ps->match = match + ps->anchored;
+	ps->len = 0;
+	ps->rest = 0;
+}
+
+
+/* Feed n bytes of terminal output. Returns how many of them go up to the end
+ * of the prompt, or 0 if it didn't show up yet. PROMPT_NONE means the
+ * output isn't the prompt at all: what was held back is in line and len, the
+ * rest of buf from rest on */
+size_t prompt_scan(PromptScan *ps, const char *buf, size_t n)
+{
+	size_t i, mlen = strlen(ps->match);
+
+	for (i = 0; i < n; i++) {
+		if (buf[i] == '\n' || buf[i] == '\r') {
+			/* doas starts its prompt with a '\r', nothing else may come first */
+			if (ps->anchored && (ps->len || buf[i] == '\n'))
+				goto none;
+			ps->len = 0;
+			continue;
+		}
+		if (ps->anchored && ps->len < mlen && buf[i] != ps->match[ps->len])
+			goto none;
+		if (ps->len < sizeof(ps->line) - 1)
+			ps->line[ps->len++] = buf[i];
+		if (buf[i] != ':')
+			continue;
+
+		ps->line[ps->len] = '\0';
+		if (!*ps->match || strcasestr(ps->line, ps->match)) {
+			/* The blank after the colon belongs to the prompt too */
+			while (i + 1 < n && buf[i + 1] == ' ')
+				i++;
+			return i + 1;
+		}
+	}
+	return 0;
+
+none:
+	ps->rest = i;
+	return PROMPT_NONE;
+}
+
+
+/* The prompt is often out before echo is turned off (and the input flushed),
+ * the password can't go in until then */
+int pty_echo_off(int fdpty)
+{
+	struct termios t;
+
+	if (tcgetattr(fdpty, &t) < 0)
+		return 1;
+	return !(t.c_lflag & ECHO);
+}
+
+
+/* Answer the prompt */
+int pty_send_password(int fdpty, const char *password)
+{
+	char buf[66];
+	size_t len = strlen(password);
+	ssize_t n;
+
+	if (len > sizeof(buf) - 2)
+		len = sizeof(buf) - 2;
+	memcpy(buf, password, len);
+	buf[len++] = '\n';
+	n = write(fdpty, buf, len);
+	memset(buf, '\0', sizeof(buf));
+	return n == (ssize_t)len ? 0 : -1;
+}
+
+
+/* Wait for the backend's prompt and give it the password. A NULL prompt means
+ * there's nothing to answer. When an anchored prompt turns out not to come,
+ * what was read instead goes to outfd (if >= 0). If the prompt doesn't show
+ * up otherwise the backend is put down, its terminal closed and -1 returned */
+int pty_login(pid_t pid, int fdpty, const char *prompt, const char *password, int outfd)
+{
+	char buf[BUFF_SIZE];
+	PromptScan ps;
+	fd_set rfds;
+	struct timeval tv;
+	ssize_t n;
+	size_t used = 0;
+	int status, seen = 0, waited = 0, tick;
+
+	if (!prompt)
+		return 0;
+
+	prompt_init(&ps, prompt);
+	while (waited < PROMPT_TIMEOUT * 1000) {
+		if (seen && pty_echo_off(fdpty))
+			return pty_send_password(fdpty, password);
+
+		/* Once the prompt is there we are just waiting for echo to go */
+		tick = seen ? 1 : 10;
+		tv.tv_sec = 0;
+		tv.tv_usec = tick * 1000;
+		FD_ZERO(&rfds);
+		FD_SET(fdpty, &rfds);
+		if ((n = select(fdpty + 1, &rfds, NULL, NULL, &tv)) < 0 && errno == EINTR)
+			continue;
+		if (n == 0) {
+			waited += tick;
+			continue;
+		}
+		/* The backend is gone already */
+		if (n < 0 || (n = read(fdpty, buf, sizeof(buf))) <= 0) {
+			n = 0;
+			break;
+		}
+		if ((used = prompt_scan(&ps, buf, n)) == PROMPT_NONE)
+			break;
+		if (used)
+			seen = 1;
+	}
+
+	/* No prompt where it had to be first: the backend let us through without
+	 * asking, and what we got is the command's */
+	if (ps.anchored && !seen) {
+		if (used != PROMPT_NONE)
+			ps.rest = n;
+		if (outfd >= 0) {
+			write(outfd, ps.line, ps.len);
+			write(outfd, buf + ps.rest, n - ps.rest);
+			recorder_add('O', ps.line, ps.len);
+			recorder_add('O', buf + ps.rest, n - ps.rest);
+		}
+		return 0;
+	}
+
+	warnx("No password prompt given by the backend");
+	/* It may be out of our reach already, hanging up gets it anyway */
+	kill(pid, SIGKILL);
+	close(fdpty);
+	reap(pid, &status, NULL);
+	return -1;
+}
+
+
+/* Quote every argument for sh -c, the result has to be freed */
+char *shell_join(char **argv)
+{
+	char *command, *p;
+	const char *s;
+	size_t len = 1;
+	int i;
+
+	for (i = 0; argv[i]; i++)
+		for (len += 3, s = argv[i]; *s; s++)
+			len += *s == '\'' ? 4 : 1;
+
+	if ((command = p = malloc(len)) == NULL)
+		return NULL;
+
+	for (i = 0; argv[i]; i++) {
+		if (i)
+			*p++ = ' ';
+		*p++ = '\'';
+		for (s = argv[i]; *s; s++)
+			if (*s == '\'') {
+				memcpy(p, "'\\''", 4);
+				p += 4;
+			}
+			else
+				*p++ = *s;
+		*p++ = '\'';
+	}
+	*p = '\0';
+	return command;
+}